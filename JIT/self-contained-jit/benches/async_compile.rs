@@ -0,0 +1,150 @@
+use std::ffi::{CString, c_void};
+use std::hint::black_box;
+use std::sync::atomic::{AtomicPtr, Ordering};
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const NUM_FUNCTIONS: i32 = 300;
+const BODY_LENGTH: i32 = 50;
+
+type Function = unsafe extern "C" fn(i32) -> i32;
+
+fn create_body(arena: *const c_void, seed: i32) -> *const c_void {
+    unsafe {
+        let x = create_parameter(arena, 0);
+        let mut body = x;
+        for i in 0..BODY_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, seed + i)
+            } else {
+                x
+            };
+            body = create_add_integer(arena, body, operand);
+        }
+        body
+    }
+}
+
+fn evaluate_body(seed: i32, x: i32) -> i32 {
+    (0..BODY_LENGTH).fold(x, |value, i| {
+        value.wrapping_add(if i % 2 == 0 { seed + i } else { x })
+    })
+}
+
+// A module of `prefix0` to `prefix{NUM_FUNCTIONS - 1}`.
+fn create_module(arena: *const c_void, prefix: &str) -> *const c_void {
+    let integer_type = unsafe { get_integer_type() };
+    let context = unsafe { create_context() };
+    for index in 0..NUM_FUNCTIONS {
+        let name = CString::new(format!("{prefix}{index}")).unwrap();
+        unsafe {
+            add_function(context, name.as_ptr(), integer_type, 1, &integer_type, 1);
+            set_insert_point(context, 0);
+            add_return(context, create_body(arena, index));
+        }
+    }
+    context
+}
+
+unsafe extern "C" fn on_compiled(user_data: *mut c_void, function: *const c_void) {
+    let slot = unsafe { &*(user_data as *const AtomicPtr<c_void>) };
+    slot.store(function as *mut c_void, Ordering::Release);
+}
+
+// Keeps the caller busy until the handle is ready or has failed, and returns
+// how many units of other work it got done meanwhile.
+fn work_until_ready(handle: *const c_void) -> u64 {
+    let mut units = 0;
+    while unsafe { poll_compile_handle(handle) }.is_null()
+        && unsafe { get_compile_handle_error(handle) }.is_null()
+    {
+        let mut sum = 0u64;
+        for i in 0..1000 {
+            sum = sum.wrapping_add(black_box(i));
+        }
+        black_box(sum);
+        units += 1;
+    }
+    units
+}
+
+fn main() {
+    // One compile thread, so that asynchronous compilation runs beside the
+    // caller.
+    let options = JitOptions {
+        num_compile_threads: 1,
+        interpreter_threshold: 0,
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+
+    let context = create_module(arena, "sync");
+    let name = CString::new(format!("sync{}", NUM_FUNCTIONS - 1)).unwrap();
+    let start = Instant::now();
+    let function: Function = unsafe { std::mem::transmute(compile(context, name.as_ptr())) };
+    let blocked = start.elapsed().as_secs_f64() * 1e3;
+    unsafe { delete_context(context) };
+    assert_eq!(unsafe { function(1) }, evaluate_body(NUM_FUNCTIONS - 1, 1));
+    println!("compile                 blocked {blocked:8.2} ms");
+
+    let context = create_module(arena, "async");
+    let name = CString::new(format!("async{}", NUM_FUNCTIONS - 1)).unwrap();
+    let slot = AtomicPtr::new(std::ptr::null_mut());
+    let start = Instant::now();
+    let handle = unsafe {
+        compile_async(
+            context,
+            name.as_ptr(),
+            Some(on_compiled),
+            &slot as *const _ as *mut c_void,
+        )
+    };
+    let blocked = start.elapsed().as_secs_f64() * 1e3;
+    unsafe { delete_context(context) };
+    let units = work_until_ready(handle);
+    let ready = start.elapsed().as_secs_f64() * 1e3;
+    let function: Function = unsafe { std::mem::transmute(wait_compile_handle(handle)) };
+    assert_eq!(
+        slot.load(Ordering::Acquire) as *const c_void,
+        function as *const c_void
+    );
+    assert_eq!(unsafe { function(1) }, evaluate_body(NUM_FUNCTIONS - 1, 1));
+    unsafe { delete_compile_handle(handle) };
+    println!(
+        "compile_async           blocked {blocked:8.2} ms, ready after {ready:8.2} ms, {units} units of work meanwhile"
+    );
+
+    let expression = create_body(arena, -1);
+    let start = Instant::now();
+    let handle = unsafe {
+        compile_expression_async(
+            expression,
+            integer_type,
+            1,
+            &integer_type,
+            None,
+            std::ptr::null_mut(),
+        )
+    };
+    let blocked = start.elapsed().as_secs_f64() * 1e3;
+    let units = work_until_ready(handle);
+    let ready = start.elapsed().as_secs_f64() * 1e3;
+    let function: Function = unsafe { std::mem::transmute(wait_compile_handle(handle)) };
+    assert_eq!(unsafe { function(1) }, evaluate_body(-1, 1));
+    unsafe { delete_compile_handle(handle) };
+    println!(
+        "compile_expression_async blocked {blocked:8.2} ms, ready after {ready:8.2} ms, {units} units of work meanwhile"
+    );
+
+    // A function that was never added fails the handle instead of the process.
+    let context = unsafe { create_context() };
+    let handle = unsafe { compile_async(context, c"missing".as_ptr(), None, std::ptr::null_mut()) };
+    unsafe { delete_context(context) };
+    assert!(unsafe { wait_compile_handle(handle) }.is_null());
+    assert!(!unsafe { get_compile_handle_error(handle) }.is_null());
+    unsafe { delete_compile_handle(handle) };
+}
@@ -0,0 +1,78 @@
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const NUM_ROWS: usize = 1 << 20;
+const ROUNDS: usize = 50;
+
+fn report(label: &str, start: Instant) {
+    let elements = (NUM_ROWS * ROUNDS) as f64 / start.elapsed().as_secs_f64();
+    println!("{label:<8} {:10.1} M elements/s", elements / 1e6);
+}
+
+fn main() {
+    // The loop is only vectorized with optimization.
+    let options = JitOptions {
+        opt_level: 2,
+        tune_for_host: true,
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let parameters_type = [integer_type, integer_type];
+    // ((x + y) + 3) + x
+    let expression = unsafe {
+        let arena = create_expression_arena();
+        let x = create_parameter(arena, 0);
+        let y = create_parameter(arena, 1);
+        let sum = create_add_integer(arena, x, y);
+        create_add_integer(
+            arena,
+            create_add_integer(arena, sum, create_integer(arena, 3)),
+            x,
+        )
+    };
+    let scalar: unsafe extern "C" fn(i32, i32) -> i32 = unsafe {
+        std::mem::transmute(compile_expression(
+            expression,
+            integer_type,
+            2,
+            parameters_type.as_ptr(),
+        ))
+    };
+    let batch: unsafe extern "C" fn(usize, *const *const c_void, *mut i32) = unsafe {
+        std::mem::transmute(compile_expression_batch(
+            expression,
+            integer_type,
+            2,
+            parameters_type.as_ptr(),
+        ))
+    };
+
+    let xs: Vec<i32> = (0..NUM_ROWS as i32).collect();
+    let ys: Vec<i32> = (0..NUM_ROWS as i32).map(|i| i.wrapping_mul(7)).collect();
+    let mut scalar_results = vec![0; NUM_ROWS];
+    let mut batch_results = vec![0; NUM_ROWS];
+
+    let start = Instant::now();
+    for _ in 0..ROUNDS {
+        for row in 0..NUM_ROWS {
+            scalar_results[row] = unsafe { scalar(black_box(xs[row]), ys[row]) };
+        }
+        black_box(&mut scalar_results);
+    }
+    report("scalar", start);
+
+    let columns = [xs.as_ptr() as *const c_void, ys.as_ptr() as *const c_void];
+    let start = Instant::now();
+    for _ in 0..ROUNDS {
+        unsafe { batch(NUM_ROWS, columns.as_ptr(), batch_results.as_mut_ptr()) };
+        black_box(&mut batch_results);
+    }
+    report("batch", start);
+
+    assert_eq!(scalar_results, batch_results);
+}
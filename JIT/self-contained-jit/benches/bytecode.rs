@@ -0,0 +1,76 @@
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const ITERATIONS: usize = 10_000;
+
+// x + 0 + g(x + 1) + 2 + g(x + 3) + ..., with `length` terms.
+fn create_chain(arena: *const c_void, length: i32) -> *const c_void {
+    unsafe {
+        let integer_type = get_integer_type();
+        let x = create_parameter(arena, 0);
+        let g = create_function(arena, c"g".as_ptr(), integer_type, 1, &integer_type, false);
+        let mut expression = x;
+        for i in 0..length {
+            let mut term = create_integer(arena, i);
+            if i % 2 == 1 {
+                let argument = create_add_integer(arena, x, term);
+                term = create_call(arena, g, integer_type, 1, &integer_type, false, &argument);
+            }
+            expression = create_add_integer(arena, expression, term);
+        }
+        expression
+    }
+}
+
+fn encoded_size(expression: *const c_void) -> usize {
+    unsafe { encode_expression(expression, std::ptr::null_mut(), 0) }
+}
+
+// Compiles the constructor and reports its size, as the length of its own
+// encoding, along with the time to compile it and to run it once.
+fn measure(
+    label: &str,
+    arena: *const c_void,
+    expression: *const c_void,
+    make_constructor: unsafe extern "C" fn(*const c_void, *const c_void) -> *const c_void,
+) {
+    let constructor = unsafe { make_constructor(arena, expression) };
+    let start = Instant::now();
+    let rebuild: unsafe extern "C" fn() -> *const c_void = unsafe {
+        std::mem::transmute(compile_expression(
+            constructor,
+            get_size_type(),
+            0,
+            std::ptr::null(),
+        ))
+    };
+    let compile_time = start.elapsed().as_secs_f64() * 1e3;
+    assert_eq!(unsafe { rebuild() }, expression);
+
+    let allocations = unsafe { get_expression_allocation_count() };
+    let start = Instant::now();
+    for _ in 0..ITERATIONS {
+        black_box(unsafe { rebuild() });
+    }
+    let run_time = start.elapsed().as_secs_f64() * 1e6 / ITERATIONS as f64;
+    assert_eq!(unsafe { get_expression_allocation_count() }, allocations);
+    println!(
+        "  {label:<8} {:8} bytes {compile_time:10.2} ms compile {run_time:10.2} us/rebuild",
+        encoded_size(constructor)
+    );
+}
+
+fn main() {
+    unsafe { initialize_jit() };
+    let arena = unsafe { create_expression_arena() };
+    for length in [10, 100, 1000] {
+        let expression = create_chain(arena, length);
+        println!("{length} terms, {} bytes encoded", encoded_size(expression));
+        measure("tree", arena, expression, to_constructor_tree);
+        measure("bytecode", arena, expression, to_constructor);
+    }
+}
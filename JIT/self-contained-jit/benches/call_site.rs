@@ -0,0 +1,137 @@
+use std::ffi::{CStr, c_void};
+use std::hint::black_box;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const ITERATIONS: i32 = 10_000_000;
+
+type Function = unsafe extern "C" fn(i32) -> i32;
+type RuntimeCallee = unsafe extern "C" fn(i32, usize) -> i32;
+
+fn measure(label: &str, function: Function) -> f64 {
+    let start = Instant::now();
+    for i in 0..ITERATIONS {
+        black_box(unsafe { function(black_box(i)) });
+    }
+    let per_call = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    println!("{label:<24} {per_call:8.2} ns/call");
+    per_call
+}
+
+// Cycles through `callees`, one per call.
+fn measure_runtime_callee(label: &str, function: RuntimeCallee, callees: &[*const c_void]) -> f64 {
+    let start = Instant::now();
+    for i in 0..ITERATIONS {
+        let callee = callees[i as usize % callees.len()];
+        black_box(unsafe { function(black_box(i), black_box(callee as usize)) });
+    }
+    let per_call = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    println!("{label:<24} {per_call:8.2} ns/call");
+    per_call
+}
+
+fn main() {
+    unsafe { initialize_jit() };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+
+    // The callee `Parameter 0` is compiled once and called both directly and
+    // through a `Call` site whose callee expression is a constant. The
+    // argument `x + 1` is not a value, so the call is not inlined; with the
+    // argument `x`, it is.
+    let callee = unsafe { create_parameter(arena, 0) };
+    let direct = unsafe {
+        std::mem::transmute::<_, Function>(compile_expression(
+            callee,
+            integer_type,
+            1,
+            &integer_type,
+        ))
+    };
+    let compile_call = |name: &CStr, argument: *const c_void| unsafe {
+        let context = create_context();
+        add_function(context, name.as_ptr(), integer_type, 1, &integer_type, 1);
+        set_insert_point(context, 0);
+        add_return(
+            context,
+            create_call(
+                arena,
+                create_size(arena, callee as usize),
+                integer_type,
+                1,
+                &integer_type,
+                false,
+                &argument,
+            ),
+        );
+        let pointer = compile(context, name.as_ptr());
+        delete_context(context);
+        std::mem::transmute::<_, Function>(pointer)
+    };
+    let through_call_site = compile_call(c"call_site", unsafe {
+        create_add_integer(arena, create_parameter(arena, 0), create_integer(arena, 1))
+    });
+    let inlined = compile_call(c"inlined", unsafe { create_parameter(arena, 0) });
+
+    // The callee is the second parameter, so the call site only learns it at
+    // run time and caches the last one called through it.
+    let runtime_callee = unsafe {
+        let size_type = get_size_type();
+        let parameters_type = [integer_type, size_type];
+        let argument =
+            create_add_integer(arena, create_parameter(arena, 0), create_integer(arena, 1));
+        let context = create_context();
+        add_function(
+            context,
+            c"runtime_callee".as_ptr(),
+            integer_type,
+            2,
+            parameters_type.as_ptr(),
+            1,
+        );
+        set_insert_point(context, 0);
+        add_return(
+            context,
+            create_call(
+                arena,
+                create_parameter(arena, 1),
+                integer_type,
+                1,
+                &integer_type,
+                false,
+                &argument,
+            ),
+        );
+        let pointer = compile(context, c"runtime_callee".as_ptr());
+        delete_context(context);
+        std::mem::transmute::<_, RuntimeCallee>(pointer)
+    };
+    let other_callee =
+        unsafe { create_add_integer(arena, create_parameter(arena, 0), create_integer(arena, 1)) };
+    // Switching callees must never pair one callee with another's code.
+    for i in 0..1000 {
+        let (callee, expected) = if i % 3 == 0 {
+            (other_callee, i + 2)
+        } else {
+            (callee, i + 1)
+        };
+        assert_eq!(unsafe { runtime_callee(i, callee as usize) }, expected);
+    }
+
+    let direct_time = measure("direct", direct);
+    let call_site_time = measure("through call site", through_call_site);
+    measure("inlined", inlined);
+    measure_runtime_callee("run-time callee", runtime_callee, &[callee]);
+    measure_runtime_callee(
+        "alternating callees",
+        runtime_callee,
+        &[callee, other_callee],
+    );
+    println!(
+        "{:<24} {:8.2} ns/call",
+        "call site overhead",
+        call_site_time - direct_time
+    );
+}
@@ -0,0 +1,204 @@
+// The backend's C API as the benchmarks use it, declared once for all of
+// them.
+#![allow(dead_code)]
+
+use std::ffi::{c_char, c_int, c_void};
+
+#[repr(C)]
+pub struct JitOptions {
+    pub opt_level: u32,
+    pub tune_for_host: bool,
+    pub tier_up_threshold: usize,
+    pub cache_directory: *const c_char,
+    pub num_compile_threads: u32,
+    pub lazy_compilation: bool,
+    pub interpreter_threshold: usize,
+    pub search_process_symbols: bool,
+    pub profiler_support: bool,
+    pub profile_execution: bool,
+    pub profile_cycles: bool,
+    pub profile_guided_recompilation: bool,
+}
+
+impl Default for JitOptions {
+    // The options initialize_jit uses.
+    fn default() -> Self {
+        let mut options = std::mem::MaybeUninit::uninit();
+        unsafe {
+            get_default_jit_options(options.as_mut_ptr());
+            options.assume_init()
+        }
+    }
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub union RuntimeValue {
+    pub integer: i32,
+    pub size: usize,
+    pub string: [usize; 2],
+}
+
+#[repr(C)]
+pub struct JitStats {
+    pub ir_build_time: u64,
+    pub optimization_time: u64,
+    pub code_generation_time: u64,
+    pub linking_time: u64,
+    pub lookup_time: u64,
+    pub num_modules: usize,
+    pub num_functions: usize,
+    pub num_instructions: usize,
+    pub code_bytes: usize,
+}
+
+#[repr(C)]
+pub struct JitMemoryStats {
+    pub code_bytes: usize,
+    pub data_bytes: usize,
+    pub num_objects: usize,
+}
+
+#[repr(C)]
+pub struct FunctionProfileStats {
+    pub name: *const c_char,
+    pub entry_count: u64,
+    pub cycles: u64,
+    pub num_call_sites: usize,
+}
+
+#[repr(C)]
+pub struct CallSiteStats {
+    pub callee: *const c_char,
+    pub count: u64,
+    pub target: *const c_void,
+    pub target_count: u64,
+}
+
+pub type Callback = Option<unsafe extern "C" fn(*mut c_void, *const c_void)>;
+
+unsafe extern "C" {
+    pub fn get_integer_type() -> *const c_void;
+    pub fn get_size_type() -> *const c_void;
+    pub fn create_expression_arena() -> *const c_void;
+    pub fn delete_expression_arena(arena: *const c_void);
+    pub fn get_expression_allocation_count() -> usize;
+    pub fn encode_expression(
+        expression: *const c_void,
+        buffer: *mut c_char,
+        capacity: usize,
+    ) -> usize;
+    pub fn to_constructor(arena: *const c_void, expression: *const c_void) -> *const c_void;
+    pub fn to_constructor_tree(arena: *const c_void, expression: *const c_void) -> *const c_void;
+    pub fn create_parameter(arena: *const c_void, index: i32) -> *const c_void;
+    pub fn create_integer(arena: *const c_void, value: i32) -> *const c_void;
+    pub fn create_add_integer(
+        arena: *const c_void,
+        left: *const c_void,
+        right: *const c_void,
+    ) -> *const c_void;
+    pub fn create_size(arena: *const c_void, value: usize) -> *const c_void;
+    pub fn create_string(arena: *const c_void, length: usize, pointer: *const u8) -> *const c_void;
+    pub fn create_print(arena: *const c_void, string: *const c_void) -> *const c_void;
+    pub fn create_array(
+        arena: *const c_void,
+        element_type: *const c_void,
+        num_elements: usize,
+        elements: *const *const c_void,
+    ) -> *const c_void;
+    pub fn create_function(
+        arena: *const c_void,
+        name: *const c_char,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_type: *const *const c_void,
+        is_variadic: bool,
+    ) -> *const c_void;
+    pub fn create_call(
+        arena: *const c_void,
+        function: *const c_void,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_ty: *const *const c_void,
+        is_variadic: bool,
+        arguments: *const *const c_void,
+    ) -> *const c_void;
+    pub fn get_default_jit_options(options: *mut JitOptions);
+    pub fn initialize_jit();
+    pub fn initialize_jit_with_options(options: *const JitOptions);
+    pub fn register_symbol(name: *const c_char, address: *const c_void) -> bool;
+    pub fn get_materialized_function_count() -> usize;
+    pub fn stage_expression(
+        expression: *const c_void,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_type: *const *const c_void,
+    );
+    pub fn compile_expression(
+        expression: *const c_void,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_type: *const *const c_void,
+    ) -> *const c_void;
+    pub fn set_expression_name(expression: *const c_void, name: *const c_char);
+    pub fn compile_expression_batch(
+        expression: *const c_void,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_type: *const *const c_void,
+    ) -> *const c_void;
+    pub fn release_expression(expression: *const c_void);
+    pub fn evaluate_expression(
+        expression: *const c_void,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_type: *const *const c_void,
+        arguments: *const RuntimeValue,
+        result: *mut RuntimeValue,
+    );
+    pub fn compile_expression_async(
+        expression: *const c_void,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_type: *const *const c_void,
+        callback: Callback,
+        user_data: *mut c_void,
+    ) -> *const c_void;
+    pub fn poll_compile_handle(handle: *const c_void) -> *const c_void;
+    pub fn wait_compile_handle(handle: *const c_void) -> *const c_void;
+    pub fn get_compile_handle_error(handle: *const c_void) -> *const c_char;
+    pub fn delete_compile_handle(handle: *const c_void);
+    pub fn get_function_profiles(profiles: *mut FunctionProfileStats, capacity: usize) -> usize;
+    pub fn get_call_site_profiles(
+        function_name: *const c_char,
+        call_sites: *mut CallSiteStats,
+        capacity: usize,
+    ) -> usize;
+    pub fn get_expression_tier(expression: *const c_void) -> c_int;
+    pub fn get_function_tier(function_name: *const c_char) -> c_int;
+    pub fn create_context() -> *const c_void;
+    pub fn add_function(
+        context: *const c_void,
+        function_name: *const c_char,
+        return_type: *const c_void,
+        num_parameters: usize,
+        parameters_type: *const *const c_void,
+        num_blocks: usize,
+    ) -> *const c_void;
+    pub fn set_insert_point(context: *const c_void, block_index: usize);
+    pub fn add_return(context: *const c_void, expression: *const c_void);
+    pub fn compile(context: *const c_void, function_name: *const c_char) -> *const c_void;
+    pub fn lookup_function(function_name: *const c_char) -> *const c_void;
+    pub fn compile_async(
+        context: *const c_void,
+        function_name: *const c_char,
+        callback: Callback,
+        user_data: *mut c_void,
+    ) -> *const c_void;
+    pub fn release_context(context: *const c_void) -> bool;
+    pub fn delete_context(context: *const c_void);
+    pub fn get_jit_memory_stats(stats: *mut JitMemoryStats);
+    pub fn get_jit_stats(stats: *mut JitStats);
+    pub fn start_jit_trace();
+    pub fn write_jit_trace(path: *const c_char);
+}
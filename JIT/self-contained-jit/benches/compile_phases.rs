@@ -0,0 +1,93 @@
+use std::ffi::{CString, c_void};
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const NUM_EXPRESSIONS: i32 = 200;
+const NUM_BATCHES: i32 = 20;
+const NUM_CONTEXTS: i32 = 20;
+const CHAIN_LENGTH: i32 = 20;
+
+fn create_chain(arena: *const c_void, seed: i32) -> *const c_void {
+    unsafe {
+        let x = create_parameter(arena, 0);
+        let mut expression = x;
+        for i in 0..CHAIN_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, seed + i)
+            } else {
+                x
+            };
+            expression = create_add_integer(arena, expression, operand);
+        }
+        expression
+    }
+}
+
+// Compiles scalar expressions one at a time, batch functions and context
+// functions, and shows where the time went.
+fn main() {
+    unsafe {
+        initialize_jit();
+        start_jit_trace();
+    }
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let start = Instant::now();
+    for i in 0..NUM_EXPRESSIONS {
+        let expression = create_chain(arena, i * CHAIN_LENGTH);
+        unsafe { compile_expression(expression, integer_type, 1, &integer_type) };
+        if i < NUM_BATCHES {
+            unsafe { compile_expression_batch(expression, integer_type, 1, &integer_type) };
+        }
+    }
+    for i in 0..NUM_CONTEXTS {
+        let name = CString::new(format!("f{i}")).unwrap();
+        unsafe {
+            let context = create_context();
+            add_function(context, name.as_ptr(), integer_type, 1, &integer_type, 1);
+            set_insert_point(context, 0);
+            add_return(context, create_chain(arena, -i));
+            compile(context, name.as_ptr());
+            delete_context(context);
+        }
+    }
+    let total_time = start.elapsed().as_secs_f64();
+
+    let mut stats = JitStats {
+        ir_build_time: 0,
+        optimization_time: 0,
+        code_generation_time: 0,
+        linking_time: 0,
+        lookup_time: 0,
+        num_modules: 0,
+        num_functions: 0,
+        num_instructions: 0,
+        code_bytes: 0,
+    };
+    unsafe { get_jit_stats(&mut stats) };
+    println!("total           {:8.1} ms", total_time * 1e3);
+    for (phase, time) in [
+        ("IR build", stats.ir_build_time),
+        ("optimization", stats.optimization_time),
+        ("code generation", stats.code_generation_time),
+        ("linking", stats.linking_time),
+        ("lookup", stats.lookup_time),
+    ] {
+        println!(
+            "{phase:<15} {:8.1} ms {:5.1} %",
+            time as f64 / 1e6,
+            time as f64 / 1e9 / total_time * 1e2
+        );
+    }
+    println!(
+        "{} modules {} functions {} instructions {} code bytes",
+        stats.num_modules, stats.num_functions, stats.num_instructions, stats.code_bytes
+    );
+
+    let path = std::env::temp_dir().join("jit-trace.json");
+    let path_string = CString::new(path.to_str().unwrap()).unwrap();
+    unsafe { write_jit_trace(path_string.as_ptr()) };
+    println!("trace written to {}", path.display());
+}
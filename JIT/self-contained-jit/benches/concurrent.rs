@@ -0,0 +1,144 @@
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::process::Command;
+use std::thread;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+// Half of every thread's expressions are the same in all threads, so that
+// threads race to compile them; the other half are its own.
+const NUM_EXPRESSIONS: i32 = 200;
+const CHAIN_LENGTH: i32 = 20;
+const WARM_ROUNDS: i32 = 2_000;
+
+type Apply = unsafe extern "C" fn(usize, i32) -> i32;
+
+fn create_chain(arena: *const c_void, seed: i32) -> *const c_void {
+    unsafe {
+        let mut expression = create_parameter(arena, 0);
+        for i in 0..CHAIN_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, seed + i)
+            } else {
+                create_parameter(arena, 0)
+            };
+            expression = create_add_integer(arena, expression, operand);
+        }
+        expression
+    }
+}
+
+fn evaluate_chain(seed: i32, x: i32) -> i32 {
+    (0..CHAIN_LENGTH).fold(x, |value, i| {
+        value.wrapping_add(if i % 2 == 0 { seed + i } else { x })
+    })
+}
+
+fn seed(thread_index: i32, expression_index: i32) -> i32 {
+    if expression_index % 2 == 0 {
+        expression_index * CHAIN_LENGTH
+    } else {
+        (1 + thread_index * NUM_EXPRESSIONS + expression_index) * CHAIN_LENGTH
+    }
+}
+
+// Every thread calls `apply(expression, x)`, whose call site compiles
+// `expression` on first use, first once per expression and then repeatedly.
+fn run(num_threads: i32) {
+    let options = JitOptions {
+        num_compile_threads: num_threads as u32,
+        interpreter_threshold: 0,
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() } as usize;
+    let apply: Apply = unsafe {
+        let arena = create_expression_arena();
+        let integer_type = integer_type as *const c_void;
+        let expression = create_call(
+            arena,
+            create_parameter(arena, 0),
+            integer_type,
+            1,
+            &integer_type,
+            false,
+            &create_parameter(arena, 1),
+        );
+        std::mem::transmute(compile_expression(
+            expression,
+            integer_type,
+            2,
+            [get_size_type(), integer_type].as_ptr(),
+        ))
+    };
+
+    let threads: Vec<_> = (0..num_threads)
+        .map(|thread_index| {
+            let arena = unsafe { create_expression_arena() } as usize;
+            let expressions: Vec<_> = (0..NUM_EXPRESSIONS)
+                .map(|i| {
+                    let seed = seed(thread_index, i);
+                    (create_chain(arena as *const c_void, seed) as usize, seed)
+                })
+                .collect();
+            expressions
+        })
+        .collect();
+
+    let start = Instant::now();
+    thread::scope(|scope| {
+        for expressions in &threads {
+            scope.spawn(move || {
+                for &(expression, seed) in expressions {
+                    let result = unsafe { apply(expression, 1) };
+                    assert_eq!(result, evaluate_chain(seed, 1));
+                }
+            });
+        }
+    });
+    let cold_time = start.elapsed().as_secs_f64();
+    let num_compiled = (num_threads + 1) * NUM_EXPRESSIONS / 2;
+
+    let start = Instant::now();
+    thread::scope(|scope| {
+        for expressions in &threads {
+            scope.spawn(move || {
+                for x in 0..WARM_ROUNDS {
+                    for &(expression, _) in expressions {
+                        black_box(unsafe { apply(expression, black_box(x)) });
+                    }
+                }
+            });
+        }
+    });
+    let warm_time = start.elapsed().as_secs_f64();
+    let num_calls = num_threads as f64 * (WARM_ROUNDS * NUM_EXPRESSIONS) as f64;
+
+    println!(
+        "{num_threads:>3} threads {:10.0} compiles/s {:10.1} Mcalls/s",
+        num_compiled as f64 / cold_time,
+        num_calls / warm_time / 1e6
+    );
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every thread count
+    // runs in a child process.
+    let mut arguments = std::env::args().skip(1);
+    if let Some(num_threads) = arguments.next().and_then(|count| count.parse().ok()) {
+        run(num_threads);
+        return;
+    }
+    let executable = std::env::current_exe().unwrap();
+    let max_threads = thread::available_parallelism().unwrap().get() as i32;
+    let mut num_threads = 1;
+    while num_threads <= max_threads {
+        Command::new(&executable)
+            .arg(num_threads.to_string())
+            .status()
+            .unwrap();
+        num_threads *= 2;
+    }
+}
@@ -0,0 +1,60 @@
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const ITERATIONS: usize = 1_000_000;
+
+fn main() {
+    unsafe { initialize_jit() };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+
+    // A staged call `f(x + 1, 2)`: its constructor code passes the parameter
+    // types of `f` as a constant array and the argument constructors as an
+    // array built at run time.
+    let expression = unsafe {
+        let parameters_type = [integer_type, integer_type];
+        let x = create_parameter(arena, 0);
+        create_call(
+            arena,
+            create_function(
+                arena,
+                c"f".as_ptr(),
+                integer_type,
+                2,
+                parameters_type.as_ptr(),
+                false,
+            ),
+            integer_type,
+            2,
+            parameters_type.as_ptr(),
+            false,
+            [
+                create_add_integer(arena, x, create_integer(arena, 1)),
+                create_integer(arena, 2),
+            ]
+            .as_ptr(),
+        )
+    };
+    let constructor: unsafe extern "C" fn() -> *const c_void = unsafe {
+        std::mem::transmute(compile_expression(
+            to_constructor(arena, expression),
+            get_size_type(),
+            0,
+            std::ptr::null(),
+        ))
+    };
+    assert_eq!(unsafe { constructor() }, expression);
+
+    let allocations = unsafe { get_expression_allocation_count() };
+    let start = Instant::now();
+    for _ in 0..ITERATIONS {
+        black_box(unsafe { constructor() });
+    }
+    let per_call = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    println!("staged call construction {per_call:8.1} ns");
+    assert_eq!(unsafe { get_expression_allocation_count() }, allocations);
+}
@@ -0,0 +1,133 @@
+use std::ffi::CStr;
+use std::hint::black_box;
+use std::process::Command;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const ITERATIONS: i32 = 10_000_000;
+
+type Function = unsafe extern "C" fn(i32) -> i32;
+
+// `caller(x)` calls the expression `callee(x + 1)` through a call site, so
+// that every iteration enters two functions and passes one call site.
+fn run(mode: &str) {
+    let options = JitOptions {
+        num_compile_threads: 0,
+        interpreter_threshold: 0,
+        profile_execution: mode != "off",
+        profile_cycles: mode == "cycles",
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let caller: Function = unsafe {
+        let callee =
+            create_add_integer(arena, create_parameter(arena, 0), create_integer(arena, 3));
+        set_expression_name(callee, c"callee".as_ptr());
+        compile_expression(callee, integer_type, 1, &integer_type);
+        let context = create_context();
+        add_function(
+            context,
+            c"caller".as_ptr(),
+            integer_type,
+            1,
+            &integer_type,
+            1,
+        );
+        set_insert_point(context, 0);
+        add_return(
+            context,
+            create_call(
+                arena,
+                create_size(arena, callee as usize),
+                integer_type,
+                1,
+                &integer_type,
+                false,
+                &create_add_integer(arena, create_parameter(arena, 0), create_integer(arena, 1)),
+            ),
+        );
+        let pointer = compile(context, c"caller".as_ptr());
+        delete_context(context);
+        std::mem::transmute(pointer)
+    };
+
+    let start = Instant::now();
+    for i in 0..ITERATIONS {
+        black_box(unsafe { caller(black_box(i)) });
+    }
+    let per_call = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    println!("{mode:<8} {per_call:8.2} ns/call");
+
+    let num_profiles = unsafe { get_function_profiles(std::ptr::null_mut(), 0) };
+    let mut profiles: Vec<_> = (0..num_profiles)
+        .map(|_| FunctionProfileStats {
+            name: std::ptr::null(),
+            entry_count: 0,
+            cycles: 0,
+            num_call_sites: 0,
+        })
+        .collect();
+    unsafe { get_function_profiles(profiles.as_mut_ptr(), profiles.len()) };
+    // Without profiling, no function counts anything.
+    assert!(mode != "off" || profiles.is_empty());
+    let mut is_caller_found = false;
+    for profile in &profiles {
+        let name = unsafe { CStr::from_ptr(profile.name) };
+        let is_caller = name == c"caller";
+        is_caller_found |= is_caller;
+        if is_caller {
+            assert_eq!(profile.entry_count, ITERATIONS as u64);
+            assert_eq!(profile.num_call_sites, 1);
+            assert_eq!(profile.cycles > 0, mode == "cycles");
+        }
+        println!(
+            "  {:<20} {:10} entries {:12} cycles",
+            name.to_str().unwrap(),
+            profile.entry_count,
+            profile.cycles
+        );
+        let mut call_sites: Vec<_> = (0..profile.num_call_sites)
+            .map(|_| CallSiteStats {
+                callee: std::ptr::null(),
+                count: 0,
+                target: std::ptr::null(),
+                target_count: 0,
+            })
+            .collect();
+        unsafe { get_call_site_profiles(profile.name, call_sites.as_mut_ptr(), call_sites.len()) };
+        for (index, call_site) in call_sites.iter().enumerate() {
+            if is_caller {
+                assert_eq!(call_site.count, ITERATIONS as u64);
+            }
+            let callee = unsafe { CStr::from_ptr(call_site.callee) };
+            println!(
+                "    call site {index} {:<10} {:10} calls",
+                callee.to_str().unwrap(),
+                call_site.count
+            );
+        }
+    }
+    assert_eq!(is_caller_found, mode != "off");
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every mode runs in
+    // a child process.
+    const MODES: [&str; 3] = ["off", "counts", "cycles"];
+    if let Some(mode) = std::env::args()
+        .nth(1)
+        .filter(|mode| MODES.contains(&&**mode))
+    {
+        run(&mode);
+        return;
+    }
+    let executable = std::env::current_exe().unwrap();
+    for mode in MODES {
+        let status = Command::new(&executable).arg(mode).status().unwrap();
+        assert!(status.success(), "{mode} run failed");
+    }
+}
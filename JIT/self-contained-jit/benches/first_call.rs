@@ -0,0 +1,117 @@
+use std::ffi::c_void;
+use std::process::Command;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const NUM_EXPRESSIONS: i32 = 200;
+const CHAIN_LENGTH: i32 = 20;
+const WARM_CALLS: i32 = 100_000;
+
+// chain(seed, x) + callee(x), where the callee adds 7 to its argument.
+fn create_expression(arena: *const c_void, callee: *const c_void, seed: i32) -> *const c_void {
+    unsafe {
+        let integer_type = get_integer_type();
+        let x = create_parameter(arena, 0);
+        let mut expression = x;
+        for i in 0..CHAIN_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, seed + i)
+            } else {
+                x
+            };
+            expression = create_add_integer(arena, expression, operand);
+        }
+        let call = create_call(
+            arena,
+            create_size(arena, callee as usize),
+            integer_type,
+            1,
+            &integer_type,
+            false,
+            &x,
+        );
+        create_add_integer(arena, expression, call)
+    }
+}
+
+fn evaluate_chain(seed: i32, x: i32) -> i32 {
+    let chain = (0..CHAIN_LENGTH).fold(x, |value, i| {
+        value.wrapping_add(if i % 2 == 0 { seed + i } else { x })
+    });
+    chain + x + 7
+}
+
+fn evaluate(expression: *const c_void, x: i32) -> i32 {
+    let integer_type = unsafe { get_integer_type() };
+    let argument = RuntimeValue { integer: x };
+    let mut result = RuntimeValue { size: 0 };
+    unsafe {
+        evaluate_expression(
+            expression,
+            integer_type,
+            1,
+            &integer_type,
+            &argument,
+            &mut result,
+        );
+        result.integer
+    }
+}
+
+fn run(interpreter_threshold: usize) {
+    let options = JitOptions {
+        num_compile_threads: 0,
+        interpreter_threshold,
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let arena = unsafe { create_expression_arena() };
+    let callee =
+        unsafe { create_add_integer(arena, create_parameter(arena, 0), create_integer(arena, 7)) };
+
+    let expressions: Vec<_> = (0..NUM_EXPRESSIONS)
+        .map(|i| create_expression(arena, callee, i * CHAIN_LENGTH))
+        .collect();
+    let start = Instant::now();
+    for (i, &expression) in expressions.iter().enumerate() {
+        let seed = i as i32 * CHAIN_LENGTH;
+        assert_eq!(evaluate(expression, 1), evaluate_chain(seed, 1));
+    }
+    let first_call = start.elapsed().as_secs_f64() / NUM_EXPRESSIONS as f64;
+
+    let start = Instant::now();
+    let mut sum = 0i32;
+    for x in 0..WARM_CALLS {
+        sum = sum.wrapping_add(evaluate(expressions[0], x));
+    }
+    let warm_call = start.elapsed().as_secs_f64() / WARM_CALLS as f64;
+    let expected = (0..WARM_CALLS).fold(0i32, |sum, x| sum.wrapping_add(evaluate_chain(0, x)));
+    assert_eq!(sum, expected);
+
+    println!(
+        "threshold {interpreter_threshold:>5} first call {:10.1} us, then {:8.3} us per call",
+        first_call * 1e6,
+        warm_call * 1e6
+    );
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every threshold
+    // runs in a child process.
+    if let Some(threshold) = std::env::args()
+        .nth(1)
+        .and_then(|threshold| threshold.parse().ok())
+    {
+        run(threshold);
+        return;
+    }
+    let executable = std::env::current_exe().unwrap();
+    for threshold in [0, 1, 100] {
+        Command::new(&executable)
+            .arg(threshold.to_string())
+            .status()
+            .unwrap();
+    }
+}
@@ -0,0 +1,152 @@
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const ITERATIONS: usize = 1_000_000;
+
+// Every heap allocation in the process: Rust's through the global allocator,
+// and C++'s through the replaced operator new below.
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+struct CountingAllocator;
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn dealloc(&self, pointer: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(pointer, layout) }
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+unsafe extern "C" {
+    fn malloc(size: usize) -> *mut c_void;
+    fn free(pointer: *mut c_void);
+}
+
+fn counted_new(size: usize) -> *mut c_void {
+    ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+    let pointer = unsafe { malloc(size.max(1)) };
+    if pointer.is_null() {
+        std::process::abort();
+    }
+    pointer
+}
+
+// operator new(std::size_t) and operator new[](std::size_t).
+#[unsafe(no_mangle)]
+#[allow(non_snake_case)]
+extern "C" fn _Znwm(size: usize) -> *mut c_void {
+    counted_new(size)
+}
+
+#[unsafe(no_mangle)]
+#[allow(non_snake_case)]
+extern "C" fn _Znam(size: usize) -> *mut c_void {
+    counted_new(size)
+}
+
+// operator delete and delete[], unsized and sized.
+#[unsafe(no_mangle)]
+#[allow(non_snake_case)]
+extern "C" fn _ZdlPv(pointer: *mut c_void) {
+    unsafe { free(pointer) }
+}
+
+#[unsafe(no_mangle)]
+#[allow(non_snake_case)]
+extern "C" fn _ZdaPv(pointer: *mut c_void) {
+    unsafe { free(pointer) }
+}
+
+#[unsafe(no_mangle)]
+#[allow(non_snake_case)]
+extern "C" fn _ZdlPvm(pointer: *mut c_void, _size: usize) {
+    unsafe { free(pointer) }
+}
+
+#[unsafe(no_mangle)]
+#[allow(non_snake_case)]
+extern "C" fn _ZdaPvm(pointer: *mut c_void, _size: usize) {
+    unsafe { free(pointer) }
+}
+
+#[unsafe(no_mangle)]
+extern "C" fn host_add_one(x: i32) -> i32 {
+    x + 1
+}
+
+// Calls `function` in a loop and asserts that it neither allocates nor
+// changes its result.
+fn measure<T: PartialEq + std::fmt::Debug>(label: &str, function: impl Fn(i32) -> T) {
+    let expected = function(0);
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+    let start = Instant::now();
+    for _ in 0..ITERATIONS {
+        black_box(function(black_box(0)));
+    }
+    let per_call = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    let allocated = ALLOCATIONS.load(Ordering::Relaxed) - allocations;
+    println!("{label:<24} {per_call:8.2} ns/call, {allocated} allocations");
+    assert_eq!(allocated, 0);
+    assert_eq!(function(0), expected);
+}
+
+// Compiled code that evaluates a Function expression, or calls through one,
+// allocates nothing once it is running.
+fn main() {
+    unsafe { initialize_jit() };
+    let integer_type = unsafe { get_integer_type() };
+    let size_type = unsafe { get_size_type() };
+    let arena = unsafe { create_expression_arena() };
+    let function = unsafe {
+        create_function(
+            arena,
+            c"host_add_one".as_ptr(),
+            integer_type,
+            1,
+            &integer_type,
+            false,
+        )
+    };
+    let reference = unsafe {
+        std::mem::transmute::<_, unsafe extern "C" fn() -> usize>(compile_expression(
+            function,
+            size_type,
+            0,
+            std::ptr::null(),
+        ))
+    };
+    let call = unsafe {
+        let argument = create_parameter(arena, 0);
+        let call = create_call(
+            arena,
+            function,
+            integer_type,
+            1,
+            &integer_type,
+            false,
+            &argument,
+        );
+        std::mem::transmute::<_, unsafe extern "C" fn(i32) -> i32>(compile_expression(
+            call,
+            integer_type,
+            1,
+            &integer_type,
+        ))
+    };
+    assert_eq!(unsafe { call(41) }, 42);
+
+    measure("function reference", |_| unsafe { reference() });
+    measure("call through reference", |x| unsafe { call(x) });
+}
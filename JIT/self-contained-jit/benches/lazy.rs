@@ -0,0 +1,103 @@
+use std::ffi::CString;
+use std::process::Command;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+// A program of many functions of which only a few are ever called.
+const NUM_FUNCTIONS: i32 = 1000;
+const NUM_CALLED: i32 = 10;
+const BODY_LENGTH: i32 = 50;
+
+type Function = unsafe extern "C" fn(i32) -> i32;
+
+fn function_name(index: i32) -> CString {
+    CString::new(format!("f{index}")).unwrap()
+}
+
+// f{index}(x) = ((x + index) + x) + (index + 1) + x + ...
+fn evaluate(index: i32, x: i32) -> i32 {
+    (0..BODY_LENGTH).fold(x, |value, i| {
+        value.wrapping_add(if i % 2 == 0 { index + i } else { x })
+    })
+}
+
+fn run(lazy_compilation: bool) {
+    let options = JitOptions {
+        num_compile_threads: 0,
+        lazy_compilation,
+        interpreter_threshold: 0,
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let context = unsafe { create_context() };
+    for index in 0..NUM_FUNCTIONS {
+        unsafe {
+            add_function(
+                context,
+                function_name(index).as_ptr(),
+                integer_type,
+                1,
+                &integer_type,
+                1,
+            );
+            set_insert_point(context, 0);
+            let x = create_parameter(arena, 0);
+            let mut body = x;
+            for i in 0..BODY_LENGTH {
+                let operand = if i % 2 == 0 {
+                    create_integer(arena, index + i)
+                } else {
+                    x
+                };
+                body = create_add_integer(arena, body, operand);
+            }
+            add_return(context, body);
+        }
+    }
+
+    let start = Instant::now();
+    let first: Function =
+        unsafe { std::mem::transmute(compile(context, function_name(0).as_ptr())) };
+    let compile_time = start.elapsed().as_secs_f64() * 1e3;
+    unsafe { delete_context(context) };
+    assert_eq!(unsafe { first(1) }, evaluate(0, 1));
+    let start = Instant::now();
+    for index in 1..NUM_CALLED {
+        let function: Function =
+            unsafe { std::mem::transmute(lookup_function(function_name(index).as_ptr())) };
+        assert_eq!(unsafe { function(1) }, evaluate(index, 1));
+    }
+    let call_time = start.elapsed().as_secs_f64() * 1e3;
+    let num_materialized = unsafe { get_materialized_function_count() };
+    println!(
+        "{:<6} {compile_time:10.1} ms compile {call_time:10.1} ms first calls {num_materialized:6} functions materialized",
+        if lazy_compilation { "lazy" } else { "eager" },
+    );
+    // Only the functions that were called are compiled lazily.
+    let expected = if lazy_compilation {
+        NUM_CALLED
+    } else {
+        NUM_FUNCTIONS
+    };
+    assert_eq!(num_materialized, expected as usize);
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so each mode runs in a
+    // child process.
+    match std::env::args().nth(1).as_deref() {
+        Some("eager") => run(false),
+        Some("lazy") => run(true),
+        _ => {
+            let executable = std::env::current_exe().unwrap();
+            for mode in ["eager", "lazy"] {
+                let status = Command::new(&executable).arg(mode).status().unwrap();
+                assert!(status.success(), "{mode} run failed");
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+use std::ffi::{CString, c_void};
+use std::process::Command;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const NUM_FUNCTIONS: i32 = 200;
+const NUM_EXPRESSIONS: i32 = 200;
+const CHAIN_LENGTH: i32 = 100;
+
+fn create_chain(arena: *const c_void, seed: i32) -> *const c_void {
+    unsafe {
+        let mut expression = create_parameter(arena, 0);
+        for i in 0..CHAIN_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, seed * CHAIN_LENGTH + i)
+            } else {
+                create_parameter(arena, 0)
+            };
+            expression = create_add_integer(arena, expression, operand);
+        }
+        expression
+    }
+}
+
+// Compiles a Context with NUM_FUNCTIONS functions and NUM_EXPRESSIONS staged
+// expressions, the same ones in every run.
+fn run(cache_directory: &str) {
+    let cache_directory = CString::new(cache_directory).unwrap();
+    let options = JitOptions {
+        opt_level: 3,
+        cache_directory: cache_directory.as_ptr(),
+        num_compile_threads: 0,
+        interpreter_threshold: 0,
+        ..Default::default()
+    };
+    let start = Instant::now();
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let names: Vec<_> = (0..NUM_FUNCTIONS)
+        .map(|i| CString::new(format!("f{i}")).unwrap())
+        .collect();
+    unsafe {
+        let context = create_context();
+        for (i, name) in names.iter().enumerate() {
+            add_function(context, name.as_ptr(), integer_type, 1, &integer_type, 1);
+            set_insert_point(context, 0);
+            add_return(context, create_chain(arena, i as i32));
+        }
+        compile(context, names[0].as_ptr());
+    }
+    let expressions: Vec<_> = (0..NUM_EXPRESSIONS)
+        .map(|i| create_chain(arena, NUM_FUNCTIONS + i))
+        .collect();
+    for &expression in &expressions {
+        unsafe { stage_expression(expression, integer_type, 1, &integer_type) };
+    }
+    for &expression in &expressions {
+        unsafe { compile_expression(expression, integer_type, 1, &integer_type) };
+    }
+    println!("{:8.1} ms", start.elapsed().as_secs_f64() * 1e3);
+}
+
+fn main() {
+    // A cold and a warm start have to be separate processes.
+    let mut arguments = std::env::args().skip(1);
+    if let Some(cache_directory) = arguments.next().filter(|argument| argument != "--bench") {
+        run(&cache_directory);
+        return;
+    }
+    let cache_directory =
+        std::env::temp_dir().join(format!("object-cache-bench-{}", std::process::id()));
+    let executable = std::env::current_exe().unwrap();
+    for label in ["cold", "warm"] {
+        print!("{label:<8}");
+        std::io::Write::flush(&mut std::io::stdout()).unwrap();
+        Command::new(&executable)
+            .arg(&cache_directory)
+            .status()
+            .unwrap();
+    }
+    std::fs::remove_dir_all(&cache_directory).unwrap();
+}
@@ -0,0 +1,89 @@
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::process::Command;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const NUM_EXPRESSIONS: usize = 200;
+const CHAIN_LENGTH: i32 = 200;
+const ITERATIONS: i32 = 1_000_000;
+
+// ((x + 0) + x) + 1) + x) + 2 ...: foldable constants interleaved with uses
+// of the parameter, so that the optimizer has something to do.
+fn create_chain(arena: *const c_void) -> *const c_void {
+    unsafe {
+        let mut expression = create_parameter(arena, 0);
+        for i in 0..CHAIN_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, i)
+            } else {
+                create_parameter(arena, 0)
+            };
+            expression = create_add_integer(arena, expression, operand);
+        }
+        expression
+    }
+}
+
+fn run(opt_level: u32, tune_for_host: bool) {
+    let options = JitOptions {
+        opt_level,
+        tune_for_host,
+        num_compile_threads: 0,
+        interpreter_threshold: 0,
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let expressions: Vec<_> = (0..NUM_EXPRESSIONS).map(|_| create_chain(arena)).collect();
+
+    let start = Instant::now();
+    for &expression in &expressions {
+        unsafe { stage_expression(expression, integer_type, 1, &integer_type) };
+    }
+    let functions: Vec<_> = expressions
+        .iter()
+        .map(|&expression| unsafe {
+            std::mem::transmute::<_, unsafe extern "C" fn(i32) -> i32>(compile_expression(
+                expression,
+                integer_type,
+                1,
+                &integer_type,
+            ))
+        })
+        .collect();
+    let compile_time = start.elapsed().as_secs_f64() * 1e3 / NUM_EXPRESSIONS as f64;
+
+    let start = Instant::now();
+    for i in 0..ITERATIONS {
+        black_box(unsafe { functions[0](black_box(i)) });
+    }
+    let run_time = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    println!(
+        "O{opt_level} {:<8} {compile_time:8.3} ms/expression {run_time:8.2} ns/call",
+        if tune_for_host { "host" } else { "generic" }
+    );
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every
+    // configuration runs in a child process.
+    let mut arguments = std::env::args().skip(1);
+    if let Some(opt_level) = arguments.next().and_then(|level| level.parse().ok()) {
+        run(opt_level, arguments.next().as_deref() == Some("host"));
+        return;
+    }
+    let executable = std::env::current_exe().unwrap();
+    for opt_level in 0..4 {
+        for cpu in ["generic", "host"] {
+            Command::new(&executable)
+                .arg(opt_level.to_string())
+                .arg(cpu)
+                .status()
+                .unwrap();
+        }
+    }
+}
@@ -0,0 +1,139 @@
+use std::ffi::CString;
+use std::process::Command;
+use std::thread;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const NUM_FUNCTIONS: i32 = 1000;
+const BODY_LENGTH: i32 = 50;
+
+fn function_name(index: i32) -> CString {
+    CString::new(format!("f{index}")).unwrap()
+}
+
+// f{index}(x) = f{index - 1}(x) + (x + index) + x + (index + 2) + ..., so
+// that partitions call into one another.
+fn evaluate(index: i32, x: i32) -> i32 {
+    let body = (0..BODY_LENGTH).fold(x, |value, i| {
+        value.wrapping_add(if i % 2 == 0 { index + i } else { x })
+    });
+    if index == 0 {
+        body
+    } else {
+        body.wrapping_add(evaluate(index - 1, x))
+    }
+}
+
+fn run(num_threads: u32) {
+    let options = JitOptions {
+        num_compile_threads: num_threads,
+        interpreter_threshold: 0,
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let context = unsafe { create_context() };
+    for index in 0..NUM_FUNCTIONS {
+        unsafe {
+            add_function(
+                context,
+                function_name(index).as_ptr(),
+                integer_type,
+                1,
+                &integer_type,
+                1,
+            );
+            set_insert_point(context, 0);
+            let x = create_parameter(arena, 0);
+            let mut body = x;
+            for i in 0..BODY_LENGTH {
+                let operand = if i % 2 == 0 {
+                    create_integer(arena, index + i)
+                } else {
+                    x
+                };
+                body = create_add_integer(arena, body, operand);
+            }
+            if index > 0 {
+                let previous = create_function(
+                    arena,
+                    function_name(index - 1).into_raw(),
+                    integer_type,
+                    1,
+                    &integer_type,
+                    false,
+                );
+                let call = create_call(arena, previous, integer_type, 1, &integer_type, false, &x);
+                body = create_add_integer(arena, body, call);
+            }
+            add_return(context, body);
+        }
+    }
+
+    let start = Instant::now();
+    let last: unsafe extern "C" fn(i32) -> i32 =
+        unsafe { std::mem::transmute(compile(context, function_name(NUM_FUNCTIONS - 1).as_ptr())) };
+    let compile_time = start.elapsed().as_secs_f64() * 1e3;
+    unsafe { delete_context(context) };
+    assert_eq!(unsafe { last(1) }, evaluate(NUM_FUNCTIONS - 1, 1));
+    println!("{num_threads:>3} threads {compile_time:10.1} ms");
+
+    // Every Context module has a private global named `array` for the constant
+    // array of its function, which partitioning must not turn into clashing
+    // definitions.
+    let elements: Vec<_> = (0..2)
+        .map(|index| unsafe {
+            let context = create_context();
+            let name = CString::new(format!("elements{index}")).unwrap();
+            add_function(
+                context,
+                name.as_ptr(),
+                get_size_type(),
+                0,
+                std::ptr::null(),
+                1,
+            );
+            set_insert_point(context, 0);
+            let values = [
+                create_integer(arena, index),
+                create_integer(arena, index + 1),
+            ];
+            add_return(
+                context,
+                create_array(arena, integer_type, 2, values.as_ptr()),
+            );
+            let function: unsafe extern "C" fn() -> *const i32 =
+                std::mem::transmute(compile(context, name.as_ptr()));
+            delete_context(context);
+            function
+        })
+        .collect();
+    for (index, function) in elements.into_iter().enumerate() {
+        let index = index as i32;
+        let array = unsafe { std::slice::from_raw_parts(function(), 2) };
+        assert_eq!(array, [index, index + 1]);
+    }
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every thread count
+    // runs in a child process.
+    if let Some(num_threads) = std::env::args().nth(1).and_then(|count| count.parse().ok()) {
+        run(num_threads);
+        return;
+    }
+    let executable = std::env::current_exe().unwrap();
+    let max_threads = thread::available_parallelism().unwrap().get() as u32;
+    let mut thread_counts = vec![1, 2, 4, 8, max_threads];
+    thread_counts.sort();
+    thread_counts.dedup();
+    for num_threads in thread_counts {
+        Command::new(&executable)
+            .arg(num_threads.to_string())
+            .status()
+            .unwrap();
+    }
+}
@@ -0,0 +1,160 @@
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::process::Command;
+use std::time::{Duration, Instant};
+
+mod common;
+use common::*;
+
+const TIER_UP_THRESHOLD: usize = 1_000;
+const ITERATIONS: i32 = 20_000_000;
+const CHAIN_LENGTH: i32 = 4;
+
+fn create_chain(arena: *const c_void, seed: i32) -> *const c_void {
+    unsafe {
+        let x = create_parameter(arena, 0);
+        let mut expression = x;
+        for i in 0..CHAIN_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, seed + i)
+            } else {
+                x
+            };
+            expression = create_add_integer(arena, expression, operand);
+        }
+        expression
+    }
+}
+
+fn evaluate_chain(seed: i32, x: i32) -> i32 {
+    (0..CHAIN_LENGTH).fold(x, |value, i| {
+        value.wrapping_add(if i % 2 == 0 { seed + i } else { x })
+    })
+}
+
+fn create_integer_call(
+    arena: *const c_void,
+    function: *const c_void,
+    argument: *const c_void,
+) -> *const c_void {
+    let integer_type = unsafe { get_integer_type() };
+    unsafe {
+        create_call(
+            arena,
+            function,
+            integer_type,
+            1,
+            &integer_type,
+            false,
+            &argument,
+        )
+    }
+}
+
+// Staged code calls small expressions through call sites: `caller(x)` calls
+// two of them through call sites with a constant callee, and `apply(f, x)`
+// calls whatever expression `f` is, which is always the same one here.
+fn run(mode: &str) {
+    let options = JitOptions {
+        tier_up_threshold: TIER_UP_THRESHOLD,
+        num_compile_threads: 1,
+        interpreter_threshold: 0,
+        profile_execution: mode != "tiered",
+        profile_guided_recompilation: mode == "guided",
+        ..Default::default()
+    };
+    unsafe { initialize_jit_with_options(&options) };
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let first = create_chain(arena, 10);
+    let second = create_chain(arena, 20);
+    let x = unsafe { create_parameter(arena, 0) };
+
+    let caller: unsafe extern "C" fn(i32) -> i32 = unsafe {
+        let context = create_context();
+        add_function(
+            context,
+            c"caller".as_ptr(),
+            integer_type,
+            1,
+            &integer_type,
+            1,
+        );
+        set_insert_point(context, 0);
+        add_return(
+            context,
+            create_add_integer(
+                arena,
+                create_integer_call(arena, create_size(arena, first as usize), x),
+                create_integer_call(arena, create_size(arena, second as usize), x),
+            ),
+        );
+        let pointer = compile(context, c"caller".as_ptr());
+        delete_context(context);
+        std::mem::transmute(pointer)
+    };
+    let apply_expression = unsafe {
+        create_integer_call(
+            arena,
+            create_parameter(arena, 0),
+            create_parameter(arena, 1),
+        )
+    };
+    let apply: unsafe extern "C" fn(usize, i32) -> i32 = unsafe {
+        std::mem::transmute(compile_expression(
+            apply_expression,
+            integer_type,
+            2,
+            [get_size_type(), integer_type].as_ptr(),
+        ))
+    };
+
+    // Runs until both callers have their optimized tier.
+    let start = Instant::now();
+    while unsafe {
+        get_function_tier(c"caller".as_ptr()) != 2 || get_expression_tier(apply_expression) != 2
+    } {
+        for i in 0..TIER_UP_THRESHOLD as i32 {
+            black_box(unsafe { caller(black_box(i)) });
+            black_box(unsafe { apply(first as usize, black_box(i)) });
+        }
+        if start.elapsed() > Duration::from_secs(30) {
+            panic!("no optimized tier after 30 s");
+        }
+    }
+    assert_eq!(
+        unsafe { caller(1) },
+        evaluate_chain(10, 1) + evaluate_chain(20, 1)
+    );
+    assert_eq!(unsafe { apply(second as usize, 1) }, evaluate_chain(20, 1));
+
+    let start = Instant::now();
+    for i in 0..ITERATIONS {
+        black_box(unsafe { caller(black_box(i)) });
+    }
+    let caller_time = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    let start = Instant::now();
+    for i in 0..ITERATIONS {
+        black_box(unsafe { apply(first as usize, black_box(i)) });
+    }
+    let apply_time = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    println!("{mode:<8} caller {caller_time:6.2} ns/call apply {apply_time:6.2} ns/call");
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every mode runs in
+    // a child process. "profiled" keeps counting in the optimized tier;
+    // "guided" compiles it with the profile instead.
+    const MODES: [&str; 3] = ["tiered", "profiled", "guided"];
+    if let Some(mode) = std::env::args()
+        .nth(1)
+        .filter(|mode| MODES.contains(&&**mode))
+    {
+        run(&mode);
+        return;
+    }
+    let executable = std::env::current_exe().unwrap();
+    for mode in MODES {
+        Command::new(&executable).arg(mode).status().unwrap();
+    }
+}
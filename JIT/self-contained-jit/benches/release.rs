@@ -0,0 +1,138 @@
+use std::ffi::{CString, c_void};
+use std::process::Command;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const ROUNDS: i32 = 400;
+const EXPRESSIONS_PER_ROUND: i32 = 10;
+const CHAIN_LENGTH: i32 = 20;
+
+type Function = unsafe extern "C" fn(i32) -> i32;
+
+fn create_chain(arena: *const c_void, seed: i32) -> *const c_void {
+    unsafe {
+        let x = create_parameter(arena, 0);
+        let mut expression = x;
+        for i in 0..CHAIN_LENGTH {
+            let operand = if i % 2 == 0 {
+                create_integer(arena, seed + i)
+            } else {
+                x
+            };
+            expression = create_add_integer(arena, expression, operand);
+        }
+        expression
+    }
+}
+
+fn evaluate_chain(seed: i32, x: i32) -> i32 {
+    (0..CHAIN_LENGTH).fold(x, |value, i| {
+        value.wrapping_add(if i % 2 == 0 { seed + i } else { x })
+    })
+}
+
+fn get_memory_stats() -> JitMemoryStats {
+    let mut stats = JitMemoryStats {
+        code_bytes: 0,
+        data_bytes: 0,
+        num_objects: 0,
+    };
+    unsafe { get_jit_memory_stats(&mut stats) };
+    stats
+}
+
+fn report(round: i32, start: Instant) {
+    let stats = get_memory_stats();
+    println!(
+        "  after {round:>4} rounds {:8.1} ms {:10} code bytes {:10} data bytes {:6} objects",
+        start.elapsed().as_secs_f64() * 1e3,
+        stats.code_bytes,
+        stats.data_bytes,
+        stats.num_objects
+    );
+}
+
+// Every round compiles a batch of expressions and a context of a function,
+// calls them, and releases them or not. Once released, the JIT holds as much
+// memory after every round as after the first, which may have allocated what
+// the JIT keeps for good.
+fn run(release: bool) {
+    unsafe { initialize_jit() };
+    let integer_type = unsafe { get_integer_type() };
+    println!("{}", if release { "release" } else { "keep" });
+    let start = Instant::now();
+    let mut baseline = None;
+    for round in 0..ROUNDS {
+        let arena = unsafe { create_expression_arena() };
+        let seeds: Vec<_> = (0..EXPRESSIONS_PER_ROUND)
+            .map(|i| (round * EXPRESSIONS_PER_ROUND + i) * CHAIN_LENGTH)
+            .collect();
+        let expressions: Vec<_> = seeds
+            .iter()
+            .map(|&seed| create_chain(arena, seed))
+            .collect();
+        for &expression in &expressions {
+            unsafe { stage_expression(expression, integer_type, 1, &integer_type) };
+        }
+        for (&expression, &seed) in expressions.iter().zip(&seeds) {
+            let function: Function = unsafe {
+                std::mem::transmute(compile_expression(
+                    expression,
+                    integer_type,
+                    1,
+                    &integer_type,
+                ))
+            };
+            assert_eq!(unsafe { function(1) }, evaluate_chain(seed, 1));
+        }
+
+        let name = CString::new(format!("f{round}")).unwrap();
+        let context = unsafe { create_context() };
+        let function: Function = unsafe {
+            add_function(context, name.as_ptr(), integer_type, 1, &integer_type, 1);
+            set_insert_point(context, 0);
+            add_return(context, create_chain(arena, -round));
+            std::mem::transmute(compile(context, name.as_ptr()))
+        };
+        assert_eq!(unsafe { function(1) }, evaluate_chain(-round, 1));
+
+        if release {
+            for &expression in &expressions {
+                unsafe { release_expression(expression) };
+            }
+            assert!(unsafe { release_context(context) });
+        }
+        unsafe {
+            delete_context(context);
+            delete_expression_arena(arena);
+        }
+        if release {
+            let stats = get_memory_stats();
+            let (code_bytes, data_bytes) =
+                *baseline.get_or_insert((stats.code_bytes, stats.data_bytes));
+            assert_eq!(stats.code_bytes, code_bytes, "round {round}");
+            assert_eq!(stats.data_bytes, data_bytes, "round {round}");
+        }
+        if (round + 1) % 100 == 0 {
+            report(round + 1, start);
+        }
+    }
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every mode runs in
+    // a child process.
+    match std::env::args().nth(1).as_deref() {
+        Some("keep") => run(false),
+        Some("release") => run(true),
+        _ => {
+            let executable = std::env::current_exe().unwrap();
+            for mode in ["keep", "release"] {
+                let status = Command::new(&executable).arg(mode).status().unwrap();
+                assert!(status.success(), "{mode} run failed");
+            }
+        }
+    }
+}
@@ -0,0 +1,113 @@
+use std::ffi::c_void;
+use std::hint::black_box;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+const ITERATIONS: i32 = 10_000_000;
+const DEPTH: usize = 8;
+
+// Empty, so that the bench measures the calls rather than the terminal.
+const MESSAGE: &[u8] = b"";
+
+unsafe extern "C" {
+    static stdout: *mut c_void;
+    fn fwrite(pointer: *const c_void, size: usize, count: usize, stream: *mut c_void) -> usize;
+}
+
+// What the runtime helper print_string does.
+extern "C" fn host_print_string(length: usize, address: usize) -> i32 {
+    unsafe { fwrite(address as *const c_void, 1, length, stdout) as i32 }
+}
+
+type Function = unsafe extern "C" fn(i32) -> i32;
+
+fn measure(label: &str, function: Function) {
+    assert_eq!(unsafe { function(-5) }, -5);
+    assert_eq!(unsafe { function(5000) }, 5000);
+    let start = Instant::now();
+    for i in 0..ITERATIONS {
+        black_box(unsafe { function(black_box(i)) });
+    }
+    let per_call = start.elapsed().as_secs_f64() * 1e9 / ITERATIONS as f64;
+    println!("{label:<24} {per_call:8.2} ns/call");
+}
+
+fn compile_function(name: &std::ffi::CStr, body: *const c_void) -> Function {
+    let integer_type = unsafe { get_integer_type() };
+    unsafe {
+        let context = create_context();
+        add_function(context, name.as_ptr(), integer_type, 1, &integer_type, 1);
+        set_insert_point(context, 0);
+        add_return(context, body);
+        let pointer = compile(context, name.as_ptr());
+        delete_context(context);
+        std::mem::transmute::<_, Function>(pointer)
+    }
+}
+
+// `f(x)` adds to `x` what DEPTH prints of MESSAGE return: once through Print,
+// whose call to the runtime helper print_string is linked into the module and
+// inlined, and once calling the same function registered from the host, which
+// stays an external call.
+fn main() {
+    // The helper is only inlined with optimization.
+    let options = JitOptions {
+        opt_level: 2,
+        ..Default::default()
+    };
+    unsafe {
+        initialize_jit_with_options(&options);
+        assert!(register_symbol(
+            c"host_print_string".as_ptr(),
+            host_print_string as *const c_void,
+        ));
+    }
+    let integer_type = unsafe { get_integer_type() };
+    let size_type = unsafe { get_size_type() };
+    let arena = unsafe { create_expression_arena() };
+    let parameters_type = [size_type; 2];
+
+    let host_print = unsafe {
+        create_function(
+            arena,
+            c"host_print_string".as_ptr(),
+            integer_type,
+            2,
+            parameters_type.as_ptr(),
+            false,
+        )
+    };
+    let mut host_body = unsafe { create_parameter(arena, 0) };
+    for _ in 0..DEPTH {
+        host_body = unsafe {
+            let printed = create_call(
+                arena,
+                host_print,
+                integer_type,
+                2,
+                parameters_type.as_ptr(),
+                false,
+                [
+                    create_size(arena, MESSAGE.len()),
+                    create_size(arena, MESSAGE.as_ptr() as usize),
+                ]
+                .as_ptr(),
+            );
+            create_add_integer(arena, host_body, printed)
+        };
+    }
+
+    let string = unsafe { create_string(arena, MESSAGE.len(), MESSAGE.as_ptr()) };
+    let mut helper_body = unsafe { create_parameter(arena, 0) };
+    for _ in 0..DEPTH {
+        helper_body =
+            unsafe { create_add_integer(arena, helper_body, create_print(arena, string)) };
+    }
+
+    let host = compile_function(c"host", host_body);
+    let helper = compile_function(c"helper", helper_body);
+    measure("host function", host);
+    measure("runtime helper", helper);
+}
@@ -0,0 +1,96 @@
+use std::ffi::c_void;
+use std::process::Command;
+use std::time::Instant;
+
+mod common;
+use common::*;
+
+unsafe extern "C" {
+    fn abs(x: i32) -> i32;
+}
+
+const NUM_EXPRESSIONS: i32 = 300;
+
+// Compiles `abs(x + i)` for every `i`, so that every module links against the
+// host's `abs`.
+fn run(mode: &str) {
+    let registered = mode == "registered";
+    let options = JitOptions {
+        opt_level: 0,
+        tune_for_host: false,
+        num_compile_threads: 0,
+        interpreter_threshold: 0,
+        search_process_symbols: !registered,
+        ..Default::default()
+    };
+    unsafe {
+        // Nothing can be registered before the JIT is initialized.
+        assert!(!register_symbol(c"abs".as_ptr(), abs as *const c_void));
+        initialize_jit_with_options(&options);
+        if registered {
+            assert!(register_symbol(c"abs".as_ptr(), abs as *const c_void));
+            // The runtime defines memcpy already.
+            assert!(!register_symbol(c"memcpy".as_ptr(), abs as *const c_void));
+        }
+    }
+    let integer_type = unsafe { get_integer_type() };
+    let arena = unsafe { create_expression_arena() };
+    let expressions: Vec<_> = (0..NUM_EXPRESSIONS)
+        .map(|i| unsafe {
+            let function = create_function(
+                arena,
+                c"abs".as_ptr(),
+                integer_type,
+                1,
+                &integer_type,
+                false,
+            );
+            let argument =
+                create_add_integer(arena, create_parameter(arena, 0), create_integer(arena, i));
+            create_call(
+                arena,
+                function,
+                integer_type,
+                1,
+                &integer_type,
+                false,
+                &argument,
+            )
+        })
+        .collect();
+
+    let start = Instant::now();
+    for (i, &expression) in expressions.iter().enumerate() {
+        let function: unsafe extern "C" fn(i32) -> i32 = unsafe {
+            std::mem::transmute(compile_expression(
+                expression,
+                integer_type,
+                1,
+                &integer_type,
+            ))
+        };
+        assert_eq!(unsafe { function(-1000) }, 1000 - i as i32);
+    }
+    let time = start.elapsed().as_secs_f64();
+    println!(
+        "{mode:<10} {:8.1} us/compile",
+        time / NUM_EXPRESSIONS as f64 * 1e6
+    );
+}
+
+fn main() {
+    // The JIT can only be initialized once per process, so every mode runs in
+    // a child process.
+    const MODES: [&str; 2] = ["process", "registered"];
+    if let Some(mode) = std::env::args()
+        .nth(1)
+        .filter(|mode| MODES.contains(&&**mode))
+    {
+        run(&mode);
+        return;
+    }
+    let executable = std::env::current_exe().unwrap();
+    for mode in MODES {
+        Command::new(&executable).arg(mode).status().unwrap();
+    }
+}
@@ -1,3 +1,4 @@
+use std::path::Path;
 use std::process::Command;
 
 fn main() {
@@ -34,12 +35,38 @@ fn main() {
     )
     .unwrap();
 
+    let bindir = String::from_utf8(
+        Command::new(&llvm_config)
+            .arg("--bindir")
+            .output()
+            .unwrap()
+            .stdout,
+    )
+    .unwrap();
+
+    // The runtime helpers are assembled into bitcode, which backend.cpp
+    // includes as the elements of a byte array.
+    let out_dir = std::env::var("OUT_DIR").unwrap();
+    let bitcode_path = Path::new(&out_dir).join("runtime.bc");
+    let status = Command::new(Path::new(bindir.trim()).join("llvm-as"))
+        .arg("src/runtime.ll")
+        .arg("-o")
+        .arg(&bitcode_path)
+        .status()
+        .unwrap();
+    assert!(status.success(), "llvm-as failed on src/runtime.ll");
+    let bitcode = std::fs::read(&bitcode_path).unwrap();
+    let elements: String = bitcode.iter().map(|byte| format!("{byte},")).collect();
+    std::fs::write(Path::new(&out_dir).join("runtime_bitcode.inc"), elements).unwrap();
+
     println!("cargo::rerun-if-changed=src/backend.cpp");
     println!("cargo::rerun-if-changed=src/backend.hpp");
+    println!("cargo::rerun-if-changed=src/runtime.ll");
     cc::Build::new()
         .cpp(true)
         .warnings(false)
         .file("src/backend.cpp")
+        .include(&out_dir)
         .flags(&cxxflags)
         .compile("backend");
 
@@ -1,18 +1,68 @@
 #include "backend.hpp"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/bit.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/Triple.h"
+#include "llvm/Transforms/Utils/CallPromotionUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 static TypeContext global_type_context;
 
@@ -20,12 +70,269 @@ static llvm::ExitOnError exit_on_error;
 
 static std::unique_ptr<llvm::orc::LLJIT> jit;
 
+static JitOptions jit_options;
+
+static std::unique_ptr<llvm::orc::JITTargetMachineBuilder>
+    target_machine_builder;
+
+static std::map<std::string, std::shared_ptr<TierState>> tier_states;
+
+class DiskObjectCache;
+
+static std::unique_ptr<DiskObjectCache> object_cache;
+
+// Guards the compile queue, the tables of canonical expressions and function
+// names, and the tier states.
+//
+// Locks are taken in this order: compile_mutex, then the lock of a
+// ThreadSafeContext, then profiles_mutex. The other mutexes are only held
+// while taking none of these, except that arenas_mutex may be taken under
+// compile_mutex. Compile threads hold a context lock while they optimize and
+// generate code, so code that may run on one, such as tier_up and the
+// completions of asynchronous compiles, only takes compile_mutex with no
+// context lock held.
+static std::mutex compile_mutex;
+
+// Notified whenever resolved expressions have received their code.
+static std::condition_variable compile_finished;
+
+static CompileQueue compile_queue;
+
+static std::unordered_map<const Expression *, std::string> function_names;
+
+static std::size_t num_function_names;
+
+// Batch functions by canonical expression, and the expressions whose batch
+// function a thread is currently compiling.
+static std::unordered_map<const Expression *, void *> batch_functions;
+
+static std::unordered_set<const Expression *> compiling_batches;
+
+// Code the JIT holds for the expressions of one flushed batch. It is freed
+// once every expression with code in it has been released.
+struct CompiledModule {
+  llvm::orc::ResourceTrackerSP resource_tracker;
+  std::size_t num_expressions;
+};
+
+static std::unordered_map<const Expression *, std::shared_ptr<CompiledModule>>
+    compiled_modules;
+
+// Each batch function has a module of its own.
+static std::unordered_map<const Expression *, llvm::orc::ResourceTrackerSP>
+    batch_resource_trackers;
+
+// Expressions other than the canonical one that compile_expression has copied
+// the canonical expression's code to, so that releasing it can clear them.
+static std::unordered_map<const Expression *,
+                          std::unordered_set<Expression *>>
+    pointer_copies;
+
+// Entries of call sites with run-time callees, by callee and signature.
+// Retired entries have their key cleared and are kept, since call sites may
+// still point to them.
+static std::map<std::pair<const Expression *, const Signature *>,
+                std::unique_ptr<CallSiteEntry>>
+    call_site_entries;
+
+static std::vector<std::unique_ptr<CallSiteEntry>> retired_call_site_entries;
+
+// The callees of call_site_entries, by the canonical expression whose code
+// their entries hold, so that releasing it can retire them.
+static std::unordered_map<const Expression *,
+                          std::unordered_set<const Expression *>>
+    call_site_callees;
+
+static std::mutex ready_made_mutex;
+
+static std::unordered_map<std::string, std::unique_ptr<ReadyMade>>
+    ready_made_expressions;
+
+// The characters of decoded strings. Code refers to them by address and may
+// outlive the arena they were decoded into, so they are kept until exit.
+static std::mutex decoded_strings_mutex;
+
+static llvm::StringSet<> decoded_strings;
+
+// Host objects that generated code refers to through get_host_symbol, by the
+// name of their absolute symbol.
+static std::mutex host_symbols_mutex;
+
+static std::unordered_map<std::string, const void *> host_symbols;
+
+// How many times evaluate_expression has run each canonical expression that
+// is not compiled yet.
+static std::unordered_map<const Expression *, std::size_t> evaluation_counts;
+
+// Trampolines by return type followed by parameter types.
+static std::mutex trampolines_mutex;
+
+static std::map<std::vector<Type *>, void *> trampolines;
+
+// Profiles of the functions compiled with profile_execution, by name.
+static std::mutex profiles_mutex;
+
+static std::map<std::string, std::unique_ptr<FunctionProfile>>
+    function_profiles;
+
+static std::atomic<std::size_t> num_expression_allocations;
+
+static std::atomic<std::size_t> num_materialized_functions;
+
+static std::atomic<std::size_t> num_code_bytes;
+
+static std::atomic<std::size_t> num_data_bytes;
+
+static std::atomic<std::size_t> num_loaded_objects;
+
+enum class CompilePhase {
+  IrBuild,
+  Optimization,
+  CodeGeneration,
+  Linking,
+  Lookup,
+};
+
+static const char *const compile_phase_names[] = {
+    "IR build", "Optimization", "Code generation", "Linking", "Lookup",
+};
+
+static std::atomic<std::uint64_t> compile_phase_times[std::size(
+    compile_phase_names)];
+
+static std::atomic<std::size_t> num_optimized_modules;
+
+static std::atomic<std::size_t> num_optimized_instructions;
+
+static std::atomic<std::size_t> num_emitted_code_bytes;
+
+// One compile phase on one thread, as recorded for write_jit_trace.
+struct TraceEvent {
+  CompilePhase phase;
+  std::string detail;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::duration duration;
+  std::uint64_t thread;
+};
+
+static std::atomic<bool> is_tracing;
+
+// Guards the trace events and the start of the trace.
+static std::mutex trace_mutex;
+
+static std::vector<TraceEvent> trace_events;
+
+static std::chrono::steady_clock::time_point trace_start;
+
+// Defines an absolute symbol for a host object, under `resource_tracker` if
+// the object goes away with some code.
+static void
+define_host_symbol(const std::string &name, const void *address,
+                   const llvm::orc::ResourceTrackerSP &resource_tracker =
+                       nullptr) {
+  llvm::orc::SymbolMap symbols;
+  symbols[jit->mangleAndIntern(name)] = llvm::orc::ExecutorSymbolDef(
+      llvm::orc::ExecutorAddr::fromPtr(address),
+      llvm::JITSymbolFlags::Exported);
+  exit_on_error(jit->getMainJITDylib().define(
+      llvm::orc::absoluteSymbols(std::move(symbols)), resource_tracker));
+}
+
+// Refers to a host object that lives as long as the JIT through the absolute
+// symbol `name`, defining it on first use. Host addresses change from run to
+// run, so code that embedded them would never hit the object cache in the
+// next one; a name must therefore always stand for the same object.
+static llvm::Constant *get_host_symbol(llvm::Module &module,
+                                       const std::string &name,
+                                       const void *address,
+                                       llvm::Type *pointee_type) {
+  {
+    std::lock_guard lock(host_symbols_mutex);
+    if (host_symbols.try_emplace(name, address).second) {
+      define_host_symbol(name, address);
+    }
+  }
+  return module.getOrInsertGlobal(name, pointee_type);
+}
+
+// Keeps the module out of the object cache, for code that embeds host
+// addresses with no name to stand for them, such as those of strings and of
+// the expressions constructor code passes around. Its key would never repeat
+// in a later run.
+static void exclude_from_object_cache(llvm::Module &module) {
+  if (!module.getModuleFlag("jit.uncacheable")) {
+    module.addModuleFlag(llvm::Module::Override, "jit.uncacheable", 1);
+  }
+}
+
+// Notes that code in the module passes `address` as the arena of constructor
+// code, for take_arena_references to keep the arena alive along with the code.
+static void add_arena_reference(llvm::Module &module, std::size_t address) {
+  llvm::LLVMContext &context = module.getContext();
+  module.getOrInsertNamedMetadata("jit.arenas")
+      ->addOperand(llvm::MDNode::get(
+          context, llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
+                       llvm::Type::getInt64Ty(context), address))));
+}
+
+// Refers to a type by its encoding, under which the type context interns it.
+static llvm::Constant *get_type_symbol(llvm::Module &module,
+                                       const Type *type) {
+  ExpressionEncoder encoder;
+  encoder.write_type(type);
+  return get_host_symbol(
+      module, "type." + llvm::toHex(encoder.bytes, true), type,
+      llvm::Type::getInt8Ty(module.getContext()));
+}
+
+// Returns the ReadyMade expression of the function named `name`, creating it
+// and its `ready_made.` absolute symbol on first use.
+static ReadyMade *get_ready_made(const char *name) {
+  std::lock_guard lock(ready_made_mutex);
+  auto inserted = ready_made_expressions.try_emplace(name);
+  if (inserted.second) {
+    inserted.first->second = std::make_unique<ReadyMade>(name);
+    define_host_symbol(std::string("ready_made.") + name,
+                       inserted.first->second.get());
+  }
+  return inserted.first->second.get();
+}
+
+// Returns the ReadyMade expression of the function named `name`, or null if
+// there is none yet.
+static ReadyMade *find_ready_made(const char *name) {
+  std::lock_guard lock(ready_made_mutex);
+  auto found = ready_made_expressions.find(name);
+  return found == ready_made_expressions.end() ? nullptr : found->second.get();
+}
+
+// Returns the kept copy of the characters of a decoded string.
+static llvm::StringRef get_decoded_string(llvm::StringRef string) {
+  std::lock_guard lock(decoded_strings_mutex);
+  return decoded_strings.insert(string).first->getKey();
+}
+
 Type::~Type() = default;
 
+// Tags of types in the expression encoding.
+enum class TypeTag : unsigned char {
+  Boolean,
+  Integer,
+  Size,
+  String,
+  Float,
+  Double,
+  Vector,
+};
+
 llvm::Type *BooleanType::into_llvm_type(llvm::LLVMContext &context) const {
   return llvm::Type::getInt1Ty(context);
 }
 
+void BooleanType::encode(ExpressionEncoder &encoder) const {
+  encoder.write_byte(static_cast<unsigned char>(TypeTag::Boolean));
+}
+
 extern "C" BooleanType *get_boolean_type() {
   return &global_type_context.boolean_type;
 }
@@ -34,6 +341,10 @@ llvm::Type *IntegerType::into_llvm_type(llvm::LLVMContext &context) const {
   return llvm::IntegerType::get(context, sizeof(int) * CHAR_BIT);
 }
 
+void IntegerType::encode(ExpressionEncoder &encoder) const {
+  encoder.write_byte(static_cast<unsigned char>(TypeTag::Integer));
+}
+
 extern "C" IntegerType *get_integer_type() {
   return &global_type_context.integer_type;
 }
@@ -42,6 +353,10 @@ llvm::Type *SizeType::into_llvm_type(llvm::LLVMContext &context) const {
   return llvm::IntegerType::get(context, sizeof(std::size_t) * CHAR_BIT);
 }
 
+void SizeType::encode(ExpressionEncoder &encoder) const {
+  encoder.write_byte(static_cast<unsigned char>(TypeTag::Size));
+}
+
 extern "C" SizeType *get_size_type() { return &global_type_context.size_type; }
 
 llvm::Type *StringType::into_llvm_type(llvm::LLVMContext &context) const {
@@ -49,384 +364,2326 @@ llvm::Type *StringType::into_llvm_type(llvm::LLVMContext &context) const {
   return llvm::StructType::get(field_type, field_type);
 }
 
+void StringType::encode(ExpressionEncoder &encoder) const {
+  encoder.write_byte(static_cast<unsigned char>(TypeTag::String));
+}
+
 extern "C" StringType *get_string_type() {
   return &global_type_context.string_type;
 }
 
-Expression::Expression() : pointer(nullptr) {}
+llvm::Type *FloatType::into_llvm_type(llvm::LLVMContext &context) const {
+  return llvm::Type::getFloatTy(context);
+}
 
-Expression::~Expression() = default;
+void FloatType::encode(ExpressionEncoder &encoder) const {
+  encoder.write_byte(static_cast<unsigned char>(TypeTag::Float));
+}
 
-extern "C" void debug_print(Expression *expression) {
-  expression->debug_print(std::cout);
-  std::cout << std::endl;
+extern "C" FloatType *get_float_type() {
+  return &global_type_context.float_type;
 }
 
-extern "C" Expression *to_constructor(Expression *expression) {
-  return expression->to_constructor();
+llvm::Type *DoubleType::into_llvm_type(llvm::LLVMContext &context) const {
+  return llvm::Type::getDoubleTy(context);
 }
 
-Parameter::Parameter(int index) : index(index) {}
+void DoubleType::encode(ExpressionEncoder &encoder) const {
+  encoder.write_byte(static_cast<unsigned char>(TypeTag::Double));
+}
 
-llvm::Value *Parameter::codegen(llvm::IRBuilderBase &builder) const {
-  return builder.GetInsertBlock()->getParent()->getArg(index);
+extern "C" DoubleType *get_double_type() {
+  return &global_type_context.double_type;
 }
 
-void Parameter::debug_print(std::ostream &os) const {
-  os << "Parameter " << index;
+VectorType::VectorType(Type *element_type, std::size_t num_elements)
+    : element_type(element_type), num_elements(num_elements) {}
+
+llvm::Type *VectorType::into_llvm_type(llvm::LLVMContext &context) const {
+  return llvm::FixedVectorType::get(element_type->into_llvm_type(context),
+                                    num_elements);
 }
 
-Expression *Parameter::to_constructor() const {
-  return new Call(new Function("create_parameter", get_size_type(),
-                               {get_integer_type()}, false),
-                  get_size_type(), {get_integer_type()}, false,
-                  {new Integer(index)});
+void VectorType::encode(ExpressionEncoder &encoder) const {
+  encoder.write_byte(static_cast<unsigned char>(TypeTag::Vector));
+  encoder.write_type(element_type);
+  encoder.write_unsigned(num_elements);
 }
 
-extern "C" Parameter *create_parameter(int index) {
-  return new Parameter(index);
+extern "C" VectorType *get_vector_type(Type *element_type,
+                                       std::size_t num_elements) {
+  std::lock_guard<std::mutex> lock(global_type_context.vector_types_mutex);
+  std::unique_ptr<VectorType> &vector_type =
+      global_type_context.vector_types[{element_type, num_elements}];
+  if (!vector_type) {
+    vector_type = std::make_unique<VectorType>(element_type, num_elements);
+  }
+  return vector_type.get();
 }
 
-Boolean::Boolean(bool value) : value(value) {}
+Expression::Expression()
+    : pointer(nullptr), signature(nullptr), hash(0), arena(nullptr) {}
 
-llvm::Value *Boolean::codegen(llvm::IRBuilderBase &builder) const {
-  return builder.getInt1(value);
-}
+Expression::Expression(const Expression &other)
+    : pointer(nullptr), signature(nullptr), hash(other.hash), arena(nullptr) {}
 
-void Boolean::debug_print(std::ostream &os) const { os << "Boolean " << value; }
+Expression::~Expression() = default;
 
-Expression *Boolean::to_constructor() const {
-  return new Call(new Function("create_boolean", get_size_type(),
-                               {get_boolean_type()}, false),
-                  get_size_type(), {get_boolean_type()}, false,
-                  {new Boolean(value)});
+static bool is_equal(const Expression *left, const Expression *right) {
+  return left == right ||
+         (left->hash == right->hash && left->kind() == right->kind() &&
+          left->equals(right));
 }
 
-extern "C" Boolean *create_boolean(bool value) { return new Boolean(value); }
-
-Integer::Integer(int value) : value(value) {}
+static bool is_equal(llvm::ArrayRef<Expression *> left,
+                     llvm::ArrayRef<Expression *> right) {
+  return std::equal(left.begin(), left.end(), right.begin(), right.end(),
+                    [](const Expression *left, const Expression *right) {
+                      return is_equal(left, right);
+                    });
+}
 
-llvm::Value *Integer::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Type *integer_type =
-      get_integer_type()->into_llvm_type(builder.getContext());
-  return llvm::ConstantInt::get(integer_type, value);
+static std::size_t hash_expressions(llvm::ArrayRef<Expression *> elements) {
+  llvm::hash_code hash = llvm::hash_value(elements.size());
+  for (const Expression *element : elements) {
+    hash = llvm::hash_combine(hash, element->hash);
+  }
+  return hash;
 }
 
-void Integer::debug_print(std::ostream &os) const { os << "Integer " << value; }
+std::size_t ExpressionHash::operator()(const Expression *expression) const {
+  return expression->hash;
+}
 
-Expression *Integer::to_constructor() const {
-  return new Call(new Function("create_integer", get_size_type(),
-                               {get_integer_type()}, false),
-                  get_size_type(), {get_integer_type()}, false,
-                  {new Integer(value)});
+bool ExpressionEqual::operator()(const Expression *left,
+                                 const Expression *right) const {
+  return is_equal(left, right);
 }
 
-extern "C" Integer *create_integer(int value) { return new Integer(value); }
+// An expression and the signature of its code.
+using CanonicalKey = std::pair<Expression *, const Signature *>;
 
-AddInteger::AddInteger(Expression *left, Expression *right)
-    : left(left), right(right) {}
+struct CanonicalKeyHash {
+  std::size_t operator()(const CanonicalKey &key) const {
+    return llvm::hash_combine(key.first->hash, key.second);
+  }
+};
 
-llvm::Value *AddInteger::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Value *llvm_left = left->codegen(builder);
-  llvm::Value *llvm_right = right->codegen(builder);
-  return builder.CreateAdd(llvm_left, llvm_right);
-}
+struct CanonicalKeyEqual {
+  bool operator()(const CanonicalKey &left, const CanonicalKey &right) const {
+    return left.second == right.second && is_equal(left.first, right.first);
+  }
+};
 
-void AddInteger::debug_print(std::ostream &os) const {
-  os << "AddInteger(";
-  left->debug_print(os);
-  os << ", ";
-  right->debug_print(os);
-  os << ")";
-}
+// One expression per distinct structure and signature that has been staged or
+// compiled, from whichever arena it was first seen in.
+static std::unordered_set<CanonicalKey, CanonicalKeyHash, CanonicalKeyEqual>
+    canonical_expressions;
+
+// Every signature code has been compiled for, so that equal signatures are
+// compared by address.
+static std::set<Signature> signatures;
+
+// Labels from set_expression_name for expressions whose code has no name yet.
+static std::unordered_map<const Expression *, std::string> expression_labels;
+
+static struct {
+  std::atomic<std::size_t> intern_hits;
+  std::atomic<std::size_t> intern_misses;
+  std::atomic<std::size_t> code_hits;
+  std::atomic<std::size_t> code_misses;
+} expression_cache_stats;
 
-Expression *AddInteger::to_constructor() const {
-  Expression *left_constructor = left->to_constructor();
-  Expression *right_constructor = right->to_constructor();
-  return new Call(new Function("create_add_integer", get_size_type(),
-                               {get_size_type(), get_size_type()}, false),
-                  get_size_type(), {get_size_type(), get_size_type()}, false,
-                  {left_constructor, right_constructor});
+// Callers of the functions below up to get_canonical hold compile_mutex.
+
+static const Signature *get_signature(Type *return_type,
+                                      std::size_t num_parameters,
+                                      Type **parameters_type) {
+  Signature signature{return_type};
+  signature.insert(signature.end(), parameters_type,
+                   parameters_type + num_parameters);
+  return &*signatures.insert(std::move(signature)).first;
 }
 
-extern "C" AddInteger *create_add_integer(Expression *left, Expression *right) {
-  return new AddInteger(left, right);
+// Gives the expression `signature` unless it has another one, and tells
+// whether its `pointer` may hold code of `signature`.
+static bool bind_signature(Expression *expression,
+                           const Signature *signature) {
+  if (!expression->signature) {
+    expression->signature = signature;
+  }
+  return expression->signature == signature;
 }
 
-Size::Size(std::size_t value) : value(value) {}
+static Expression *copy_expression(Expression *);
 
-llvm::Value *Size::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Type *type = get_size_type()->into_llvm_type(builder.getContext());
-  return llvm::ConstantInt::get(type, value);
+// Returns the canonical expression structurally equal to `expression` for
+// `signature`. If there is none yet, `expression` itself becomes canonical,
+// unless its code has another signature; then a copy of it does.
+static Expression *get_canonical(Expression *expression,
+                                 const Signature *signature) {
+  Expression *canonical;
+  auto found = canonical_expressions.find({expression, signature});
+  if (found != canonical_expressions.end()) {
+    canonical = found->first;
+  } else if (bind_signature(expression, signature)) {
+    canonical = expression;
+    canonical_expressions.insert({canonical, signature});
+  } else {
+    canonical = copy_expression(expression);
+    canonical->signature = signature;
+    canonical_expressions.insert({canonical, signature});
+  }
+  auto label = expression_labels.find(expression);
+  if (label != expression_labels.end() && canonical != expression) {
+    expression_labels.try_emplace(canonical, label->second);
+  }
+  return canonical;
 }
 
-void Size::debug_print(std::ostream &os) const { os << "Size " << value; }
+// Whether code the expression holds was compiled for the given signature. Only
+// to be asked once its `pointer` has been seen set, which is after its
+// signature has been; ready-made functions have none and always match.
+static bool has_signature(const Expression *expression, Type *return_type,
+                          std::size_t num_parameters, Type **parameters_type) {
+  if (!expression->signature) {
+    return true;
+  }
+  const Signature &signature = *expression->signature;
+  return signature.size() == num_parameters + 1 &&
+         signature[0] == return_type &&
+         std::equal(parameters_type, parameters_type + num_parameters,
+                    signature.begin() + 1);
+}
 
-Expression *Size::to_constructor() const {
-  return new Call(
-      new Function("create_size", get_size_type(), {get_size_type()}, false),
-      get_size_type(), {get_size_type()}, false, {new Size(value)});
+// Callers hold compile_mutex.
+static void retire_call_site_entry(const Expression *callee,
+                                   const Signature *signature) {
+  auto found = call_site_entries.find({callee, signature});
+  if (found != call_site_entries.end()) {
+    found->second->key.store(0, std::memory_order_relaxed);
+    retired_call_site_entries.push_back(std::move(found->second));
+    call_site_entries.erase(found);
+  }
 }
 
-extern "C" Size *create_size(std::size_t value) { return new Size(value); }
+// Arenas from create_expression_arena that have not been freed yet, with the
+// number of their holders: the host until it deletes the arena, and each
+// resource tracker whose code refers to it. Also the addresses of their
+// expressions, which it is safe to look into without knowing where an address
+// came from.
+static std::mutex arenas_mutex;
 
-String::String(std::size_t length, const char *pointer)
-    : length(length), pointer(pointer) {}
+static std::unordered_map<ExpressionArena *, std::size_t> arena_holders;
 
-llvm::Value *String::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Type *type = get_size_type()->into_llvm_type(builder.getContext());
-  return llvm::ConstantStruct::get(
-      llvm::StructType::get(type, type), llvm::ConstantInt::get(type, length),
-      llvm::ConstantInt::get(type, reinterpret_cast<std::size_t>(pointer)));
-}
+static llvm::DenseSet<const Expression *> expression_addresses;
 
-void String::debug_print(std::ostream &os) const {
-  os << "String \"" << std::string_view(pointer, length) << "\"";
-}
+// Held shared while expressions are simplified and their code emitted, as
+// inlining follows callees by address into arenas the caller does not own,
+// and exclusively while an arena is freed.
+static std::shared_mutex arena_deletion_mutex;
 
-Expression *String::to_constructor() const {
-  return new Call(
-      new Function("create_string", get_size_type(),
-                   {get_size_type(), get_size_type()}, false),
-      get_size_type(), {get_size_type(), get_size_type()}, false,
-      {new Size(length), new Size(reinterpret_cast<std::size_t>(pointer))});
+void *ExpressionArena::allocate(std::size_t size, std::size_t alignment) {
+  num_expression_allocations++;
+  std::lock_guard lock(mutex);
+  return allocator.Allocate(size, llvm::Align(alignment));
 }
 
-extern "C" String *create_string(std::size_t length, const char *pointer) {
-  return new String(length, pointer);
+void ExpressionArena::add(Expression *expression) {
+  expression->arena = this;
+  {
+    std::lock_guard lock(mutex);
+    expressions.push_back(expression);
+  }
+  if (is_indexed) {
+    std::lock_guard lock(arenas_mutex);
+    expression_addresses.insert(expression);
+  }
 }
 
-Print::Print(Expression *string) : string(string) {}
-
-llvm::Value *Print::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Type *llvm_integer_type =
-      get_integer_type()->into_llvm_type(builder.getContext());
-  llvm::Type *llvm_size_type =
-      get_size_type()->into_llvm_type(builder.getContext());
-  llvm::Value *llvm_string = string->codegen(builder);
-  llvm::Value *length = builder.CreateExtractValue(llvm_string, {0});
-  llvm::Value *pointer = builder.CreateExtractValue(llvm_string, {1});
-
-  llvm::Value *format = llvm::ConstantInt::get(
-      llvm_size_type, reinterpret_cast<std::size_t>("%.*s"));
+std::size_t ExpressionArena::size() {
+  std::lock_guard lock(mutex);
+  return expressions.size();
+}
 
-  llvm::FunctionType *function_type =
-      llvm::FunctionType::get(llvm_integer_type, {llvm_size_type}, true);
-  auto module = builder.GetInsertBlock()->getModule();
-  llvm::Function *function = module->getFunction("printf");
-  if (!function) {
-    function = llvm::Function::Create(
-        function_type, llvm::Function::ExternalLinkage, "printf", module);
+// `create` runs without the lock held. Should another thread intern an equal
+// expression meanwhile, the one that got in first is returned.
+Expression *ExpressionArena::intern(const Expression &key,
+                                    llvm::function_ref<Expression *()> create) {
+  {
+    std::lock_guard lock(mutex);
+    auto found = interned.find(const_cast<Expression *>(&key));
+    if (found != interned.end()) {
+      expression_cache_stats.intern_hits++;
+      return *found;
+    }
   }
-  return builder.CreateCall(function_type, function, {format, length, pointer});
+  expression_cache_stats.intern_misses++;
+  Expression *expression = create();
+  std::lock_guard lock(mutex);
+  return *interned.insert(expression).first;
 }
 
-void Print::debug_print(std::ostream &os) const {
-  os << "Print(";
-  string->debug_print(os);
-  os << ")";
+// Interns a copy of `key`, for expressions without arrays of their own.
+template <typename T> static T *intern(ExpressionArena *arena, const T &key) {
+  return static_cast<T *>(
+      arena->intern(key, [&] { return arena->create<T>(key); }));
 }
 
-Expression *Print::to_constructor() const {
-  return new Call(
-      new Function("create_print", get_size_type(), {get_size_type()}, false),
-      get_size_type(), {get_size_type()}, false, {string->to_constructor()});
+// Unlike create_call, the arguments may outnumber the parameters, for a
+// variadic callee.
+static Call *intern_call(ExpressionArena *arena, Expression *function,
+                         Type *return_type,
+                         llvm::ArrayRef<Type *> parameters_type,
+                         bool is_variadic,
+                         llvm::ArrayRef<Expression *> arguments) {
+  Call key(function, return_type, parameters_type, is_variadic, arguments);
+  return static_cast<Call *>(arena->intern(key, [&] {
+    return arena->create<Call>(function, return_type,
+                               arena->copy(parameters_type), is_variadic,
+                               arena->copy(arguments));
+  }));
 }
 
-extern "C" Print *create_print(Expression *string) { return new Print(string); }
+// State of a simplification pass. While the body of a callee is being inlined,
+// its parameters stand for `arguments`, the simplified arguments of the call.
+struct Simplifier {
+  ExpressionArena &arena;
+  llvm::ArrayRef<Expression *> arguments;
+  unsigned inlining_depth;
+  // Size of the arena when the pass started.
+  std::size_t initial_arena_size;
+  // Set when the inlined body uses a parameter the call has no argument for.
+  bool has_unbound_parameter;
+};
 
-Array::Array(Type *type, std::vector<Expression *> elements)
-    : type(type), elements(elements) {}
+// Limits the inlining of calls within inlined callees, which would not end
+// for a recursive callee.
+static constexpr unsigned max_inlining_depth = 16;
 
-llvm::Value *Array::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Type *element_type = type->into_llvm_type(builder.getContext());
-  llvm::ArrayType *array_type =
-      llvm::ArrayType::get(element_type, elements.size());
-  llvm::Value *array = builder.CreateAlloca(array_type);
-  for (std::size_t element_index = 0; element_index < elements.size();
-       element_index++) {
-    llvm::Value *element = elements[element_index]->codegen(builder);
-    llvm::Value *size =
-        builder.CreateConstGEP2_64(array_type, array, 0, element_index);
-    builder.CreateStore(element, size);
-  }
-  return array;
+// Limits the expressions a pass may add to its arena before it stops
+// inlining, as callees that call other callees more than once would grow the
+// result exponentially with the depth.
+static constexpr std::size_t max_inlined_size = 4096;
+
+static bool is_integer(const Expression *expression) {
+  return expression->kind() == ExpressionKind::Integer;
 }
 
-void Array::debug_print(std::ostream &os) const {
-  os << "Array(";
-  for (std::size_t element_index = 0; element_index < elements.size();
-       element_index++) {
-    elements[element_index]->debug_print(os);
-    if (element_index < elements.size() - 1) {
-      os << ", ";
-    }
+static int get_integer(const Expression *expression) {
+  return static_cast<const Integer *>(expression)->get_value();
+}
+
+// Values are free to evaluate and have no effects, so an argument that is one
+// may be substituted for every use of its parameter.
+static bool is_value(const Expression *expression) {
+  switch (expression->kind()) {
+  case ExpressionKind::Parameter:
+  case ExpressionKind::Boolean:
+  case ExpressionKind::Integer:
+  case ExpressionKind::Float:
+  case ExpressionKind::Double:
+  case ExpressionKind::Size:
+  case ExpressionKind::String:
+  case ExpressionKind::Function:
+  case ExpressionKind::ReadyMade:
+  case ExpressionKind::Bytecode:
+    return true;
+  default:
+    return false;
   }
-  os << ")";
 }
 
-Expression *Array::to_constructor() const {
-  std::vector<Expression *> elements_constructor;
+// Simplifies `elements` into `simplified`, and tells whether any changed.
+static bool
+simplify_expressions(Simplifier &simplifier,
+                     llvm::ArrayRef<Expression *> elements,
+                     llvm::SmallVectorImpl<Expression *> &simplified) {
+  bool is_changed = false;
   for (Expression *element : elements) {
-    elements_constructor.push_back(element->to_constructor());
+    simplified.push_back(element->simplify(simplifier));
+    is_changed |= simplified.back() != element;
   }
-  return new Call(
-      new Function("create_array", get_size_type(),
-                   {get_size_type(), get_size_type(), get_size_type()}, false),
-      get_size_type(), {get_size_type(), get_size_type(), get_size_type()},
-      false,
-      {
-          new Size(reinterpret_cast<std::size_t>(type)),
-          new Size(elements.size()),
-          new Array(get_size_type(), elements_constructor),
-      });
+  return is_changed;
 }
 
-extern "C" Array *create_array(Type *type, std::size_t num_elements,
-                               Expression **elements) {
-  std::vector<Expression *> vec_elements;
-  for (std::size_t element_index = 0; element_index < num_elements;
-       element_index++) {
-    vec_elements.push_back(elements[element_index]);
-  }
-  return new Array(type, vec_elements);
+// Simplifies `expression` into a scratch arena and emits code for the result.
+// Code refers to no expression created by simplification, so the arena only
+// has to live until the code is emitted, as do those of inlined callees.
+static llvm::Value *codegen_simplified(llvm::IRBuilderBase &builder,
+                                       Expression *expression) {
+  std::shared_lock lock(arena_deletion_mutex);
+  ExpressionArena scratch;
+  Simplifier simplifier{scratch, {}, 0, 0, false};
+  return expression->simplify(simplifier)->codegen(builder);
 }
 
-Function::Function(const char *name, Type *return_type,
-                   std::vector<Type *> parameters_type, bool is_variadic)
-    : name(name), return_type(return_type), parameters_type(parameters_type),
-      is_variadic(is_variadic) {}
+extern "C" Expression *simplify_expression(ExpressionArena *arena,
+                                           Expression *expression) {
+  std::shared_lock lock(arena_deletion_mutex);
+  Simplifier simplifier{*arena, {}, 0, arena->size(), false};
+  return expression->simplify(simplifier);
+}
 
-llvm::Value *Function::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Type *llvm_return_type =
-      return_type->into_llvm_type(builder.getContext());
-  std::vector<llvm::Type *> llvm_parameters_type;
-  for (auto &parameter_type : parameters_type) {
-    llvm_parameters_type.push_back(
-        parameter_type->into_llvm_type(builder.getContext()));
+// State of an interpretation: the values the parameters stand for, and where
+// arrays are allocated. Callees interpreted on behalf of a call share the
+// allocator, which is released when evaluate_expression returns.
+struct Interpreter {
+  llvm::ArrayRef<Type *> parameters_type;
+  llvm::ArrayRef<RuntimeValue> arguments;
+  llvm::BumpPtrAllocator &allocator;
+};
+
+static bool is_scalar(const Type *type) {
+  return type == get_boolean_type() || type == get_integer_type() ||
+         type == get_size_type() || type == get_string_type() ||
+         type == get_float_type() || type == get_double_type();
+}
+
+// Size of a value of a scalar type in memory.
+static std::size_t get_value_size(const Type *type) {
+  if (type == get_boolean_type()) {
+    return sizeof(bool);
   }
-  llvm::FunctionType *function_type = llvm::FunctionType::get(
-      llvm_return_type, llvm_parameters_type, is_variadic);
-  auto module = builder.GetInsertBlock()->getModule();
-  llvm::Function *function = module->getFunction(name);
-  if (!function) {
-    function = llvm::Function::Create(
-        function_type, llvm::Function::ExternalLinkage, name, module);
+  if (type == get_integer_type()) {
+    return sizeof(int);
   }
-  llvm::Type *llvm_size_type =
-      get_size_type()->into_llvm_type(builder.getContext());
-  llvm::FunctionType *type_create_ready_made =
-      llvm::FunctionType::get(llvm_size_type, {llvm_size_type}, false);
-  llvm::Function *llvm_create_ready_made =
-      module->getFunction("create_ready_made");
-  if (!llvm_create_ready_made) {
-    llvm_create_ready_made =
-        llvm::Function::Create(function_type, llvm::Function::ExternalLinkage,
-                               "create_ready_made", module);
+  if (type == get_float_type()) {
+    return sizeof(float);
   }
-  return builder.CreateCall(type_create_ready_made, llvm_create_ready_made,
-                            {function});
+  if (type == get_double_type()) {
+    return sizeof(double);
+  }
+  if (type == get_string_type()) {
+    return sizeof(RuntimeValue::string);
+  }
+  return sizeof(std::size_t);
 }
 
-extern "C" Expression *create_ready_made(void *pointer) {
-  Expression *ret =
-      reinterpret_cast<Expression *>(operator new(sizeof(Expression)));
-  ret->pointer = pointer;
-  return ret;
+static RuntimeValue make_size(std::size_t value) {
+  RuntimeValue result;
+  result.size = value;
+  return result;
 }
 
-void Function::debug_print(std::ostream &os) const {
-  os << "Function " << name;
+static RuntimeValue call_expression(Expression *, Type *,
+                                    llvm::ArrayRef<Type *>,
+                                    llvm::ArrayRef<RuntimeValue>,
+                                    llvm::BumpPtrAllocator &);
+
+extern "C" ExpressionArena *create_expression_arena() {
+  auto arena = new ExpressionArena(true);
+  std::lock_guard lock(arenas_mutex);
+  arena_holders.emplace(arena, 1);
+  return arena;
 }
 
-Expression *Function::to_constructor() const {
-  std::vector<Expression *> parameters_type_constructor;
-  for (Type *parameter_type : parameters_type) {
-    parameters_type_constructor.push_back(
-        new Size(reinterpret_cast<std::size_t>(parameter_type)));
-  }
-  return new Call(
-      new Function("create_function", get_size_type(),
-                   {get_size_type(), get_size_type(), get_size_type(),
-                    get_size_type(), get_boolean_type()},
-                   false),
-      get_size_type(),
-      {get_size_type(), get_size_type(), get_size_type(), get_size_type(),
-       get_boolean_type()},
-      false,
-      {
-          new Size(reinterpret_cast<std::size_t>(name)),
-          new Size(reinterpret_cast<std::size_t>(return_type)),
-          new Size(parameters_type.size()),
-          new Array(get_size_type(), parameters_type_constructor),
-          new Boolean(is_variadic),
-      });
+// Whether `address` is that of an expression in one of the arenas from
+// create_expression_arena. Callers hold arena_deletion_mutex for as long as
+// they look into it.
+static bool is_expression_address(std::size_t address) {
+  std::lock_guard lock(arenas_mutex);
+  return expression_addresses.count(
+      reinterpret_cast<const Expression *>(address));
 }
 
-Function *create_function(const char *name, Type *return_type,
-                          std::size_t num_parameters, Type **parameters_type,
-                          bool is_variadic) {
-  std::vector<Type *> vec_parameters_type;
-  for (std::size_t parameter_index = 0; parameter_index < num_parameters;
-       parameter_index++) {
-    vec_parameters_type.push_back(parameters_type[parameter_index]);
+template <typename T>
+static Expression *copy_node(ExpressionArena *arena,
+                             const Expression *expression) {
+  return arena->create<T>(*static_cast<const T *>(expression));
+}
+
+// Copies the node into its own arena without interning the copy, which shares
+// the children of the original and goes away along with it.
+static Expression *copy_expression(Expression *expression) {
+  ExpressionArena *arena = expression->arena;
+  if (!arena) {
+    exit_on_error(llvm::make_error<llvm::StringError>(
+        "cannot copy an expression that belongs to no arena",
+        llvm::inconvertibleErrorCode()));
   }
-  return new Function(name, return_type, vec_parameters_type, is_variadic);
+  switch (expression->kind()) {
+  case ExpressionKind::Parameter:
+    return copy_node<Parameter>(arena, expression);
+  case ExpressionKind::Boolean:
+    return copy_node<Boolean>(arena, expression);
+  case ExpressionKind::Integer:
+    return copy_node<Integer>(arena, expression);
+  case ExpressionKind::AddInteger:
+    return copy_node<AddInteger>(arena, expression);
+  case ExpressionKind::Float:
+    return copy_node<Float>(arena, expression);
+  case ExpressionKind::Double:
+    return copy_node<Double>(arena, expression);
+  case ExpressionKind::FloatOperation:
+    return copy_node<FloatOperation>(arena, expression);
+  case ExpressionKind::Vector:
+    return copy_node<Vector>(arena, expression);
+  case ExpressionKind::ExtractElement:
+    return copy_node<ExtractElement>(arena, expression);
+  case ExpressionKind::Size:
+    return copy_node<Size>(arena, expression);
+  case ExpressionKind::String:
+    return copy_node<String>(arena, expression);
+  case ExpressionKind::Print:
+    return copy_node<Print>(arena, expression);
+  case ExpressionKind::Array:
+    return copy_node<Array>(arena, expression);
+  case ExpressionKind::Function:
+    return copy_node<Function>(arena, expression);
+  case ExpressionKind::Call:
+    return copy_node<Call>(arena, expression);
+  case ExpressionKind::Bytecode:
+    return copy_node<Bytecode>(arena, expression);
+  case ExpressionKind::ReadyMade:
+    break;
+  }
+  llvm_unreachable("ready-made functions are not compiled");
 }
 
-Call::Call(Expression *function, Type *return_type,
-           const std::vector<Type *> &parameters_type, bool is_variadic,
-           const std::vector<Expression *> &arguments)
-    : function(function), return_type(return_type),
-      parameters_type(parameters_type), arguments(arguments),
-      is_variadic(is_variadic) {}
+// Forgets every expression of the arena in the global tables, so that nothing
+// refers to them once the allocator has released their memory. Arenas that
+// never leave the backend, such as the scratch arenas of simplification, are
+// never compiled from and skip this. Callers hold no lock.
+static void free_arena(ExpressionArena *arena) {
+  llvm::ArrayRef<Expression *> expressions = arena->get_expressions();
+  {
+    std::lock_guard lock(compile_mutex);
+    for (Expression *expression : expressions) {
+      auto canonical =
+          canonical_expressions.find({expression, expression->signature});
+      if (canonical != canonical_expressions.end()) {
+        if (canonical->first == expression) {
+          canonical_expressions.erase(canonical);
+        } else {
+          auto copies = pointer_copies.find(canonical->first);
+          if (copies != pointer_copies.end()) {
+            copies->second.erase(expression);
+          }
+        }
+      }
+      auto entry = call_site_entries.lower_bound({expression, nullptr});
+      while (entry != call_site_entries.end() &&
+             entry->first.first == expression) {
+        const Signature *signature = (entry++)->first.second;
+        auto callee_canonical =
+            canonical_expressions.find({expression, signature});
+        if (callee_canonical != canonical_expressions.end()) {
+          auto callees = call_site_callees.find(callee_canonical->first);
+          if (callees != call_site_callees.end()) {
+            callees->second.erase(expression);
+          }
+        }
+        retire_call_site_entry(expression, signature);
+      }
+      call_site_callees.erase(expression);
+      function_names.erase(expression);
+      expression_labels.erase(expression);
+      evaluation_counts.erase(expression);
+      compiled_modules.erase(expression);
+      batch_resource_trackers.erase(expression);
+      pointer_copies.erase(expression);
+      compile_queue.pending.erase(expression);
+      compile_queue.submitted.erase(expression);
+      compile_queue.resolving.erase(expression);
+      batch_functions.erase(expression);
+      compiling_batches.erase(expression);
+    }
+  }
+  std::unique_lock lock(arena_deletion_mutex);
+  delete arena;
+}
 
-llvm::Value *Call::codegen(llvm::IRBuilderBase &builder) const {
-  llvm::Type *llvm_return_type =
-      return_type->into_llvm_type(builder.getContext());
-  std::vector<llvm::Type *> llvm_parameters_type;
-  for (auto &parameter_type : parameters_type) {
-    llvm_parameters_type.push_back(
-        parameter_type->into_llvm_type(builder.getContext()));
+// Takes another holder of `arena`, unless it is not an arena from
+// create_expression_arena or has already been freed. Tells whether it was.
+static bool retain_arena(ExpressionArena *arena) {
+  std::lock_guard lock(arenas_mutex);
+  auto holders = arena_holders.find(arena);
+  if (holders == arena_holders.end()) {
+    return false;
   }
-  llvm::FunctionType *function_type = llvm::FunctionType::get(
-      llvm_return_type, llvm_parameters_type, is_variadic);
+  holders->second++;
+  return true;
+}
 
-  llvm::Value *llvm_function = function->codegen(builder);
+// Callers hold no lock, as the last holder frees the arena.
+static void release_arena(ExpressionArena *arena) {
+  {
+    std::lock_guard lock(arenas_mutex);
+    auto holders = arena_holders.find(arena);
+    if (--holders->second > 0) {
+      return;
+    }
+    arena_holders.erase(holders);
+    for (Expression *expression : arena->get_expressions()) {
+      expression_addresses.erase(expression);
+    }
+  }
+  free_arena(arena);
+}
 
-  llvm::Type *llvm_size_type =
-      get_size_type()->into_llvm_type(builder.getContext());
-  llvm::FunctionType *compile_expression_type = llvm::FunctionType::get(
-      llvm_size_type,
-      {llvm_size_type, llvm_size_type, llvm_size_type, llvm_size_type}, false);
-  auto module = builder.GetInsertBlock()->getModule();
-  llvm::Function *llvm_compile_expression =
-      module->getFunction("compile_expression");
-  if (!llvm_compile_expression) {
-    llvm_compile_expression = llvm::Function::Create(
-        compile_expression_type, llvm::Function::ExternalLinkage,
-        "compile_expression", module);
-  }
-  llvm::Value *llvm_function_pointer = builder.CreateCall(
-      compile_expression_type, llvm_compile_expression,
-      {
-          llvm_function,
-          llvm::ConstantInt::get(llvm_size_type,
-                                 reinterpret_cast<std::size_t>(return_type)),
-          llvm::ConstantInt::get(llvm_size_type, parameters_type.size()),
-          llvm::ConstantInt::get(llvm_size_type, reinterpret_cast<std::size_t>(
-                                                     &parameters_type[0])),
-      });
+extern "C" void delete_expression_arena(ExpressionArena *arena) {
+  release_arena(arena);
+}
 
-  std::vector<llvm::Value *> arguments_value;
-  for (auto &argument : arguments) {
-    arguments_value.push_back(argument->codegen(builder));
-  }
-  return builder.CreateCall(function_type, llvm_function_pointer,
-                            arguments_value);
+extern "C" void get_expression_cache_stats(ExpressionCacheStats *stats) {
+  stats->intern_hits = expression_cache_stats.intern_hits;
+  stats->intern_misses = expression_cache_stats.intern_misses;
+  stats->code_hits = expression_cache_stats.code_hits;
+  stats->code_misses = expression_cache_stats.code_misses;
 }
 
-void Call::debug_print(std::ostream &os) const {
+extern "C" std::size_t get_expression_allocation_count() {
+  return num_expression_allocations;
+}
+
+extern "C" void debug_print(Expression *expression) {
+  expression->debug_print(std::cout);
+  std::cout << std::endl;
+}
+
+// Builds a call to the create_* function `name` that passes `arena` followed
+// by `arguments`, all allocated in `arena`.
+static Expression *
+create_constructor_call(ExpressionArena &arena, const char *name,
+                        std::initializer_list<Type *> parameters_type,
+                        std::initializer_list<Expression *> arguments) {
+  std::vector<Type *> constructor_parameters_type{get_size_type()};
+  constructor_parameters_type.insert(constructor_parameters_type.end(),
+                                     parameters_type);
+  std::vector<Expression *> constructor_arguments{
+      arena.create<Size>(reinterpret_cast<std::size_t>(&arena))};
+  constructor_arguments.insert(constructor_arguments.end(), arguments);
+  llvm::ArrayRef<Type *> arena_parameters_type =
+      arena.copy<Type *>(constructor_parameters_type);
+  return arena.create<Call>(arena.create<Function>(name, get_size_type(),
+                                                   arena_parameters_type,
+                                                   false),
+                            get_size_type(), arena_parameters_type, false,
+                            arena.copy<Expression *>(constructor_arguments));
+}
+
+// Opcode of a back-reference in the expression encoding, after the kinds.
+static constexpr unsigned char reference_opcode = UINT8_MAX;
+
+void ExpressionEncoder::write_byte(unsigned char byte) {
+  bytes.push_back(byte);
+}
+
+void ExpressionEncoder::write_unsigned(std::uint64_t value) {
+  do {
+    unsigned char byte = value & 0x7f;
+    value >>= 7;
+    write_byte(value ? byte | 0x80 : byte);
+  } while (value);
+}
+
+void ExpressionEncoder::write_signed(std::int64_t value) {
+  write_unsigned((static_cast<std::uint64_t>(value) << 1) ^
+                 static_cast<std::uint64_t>(value >> 63));
+}
+
+void ExpressionEncoder::write_string(llvm::StringRef string) {
+  write_unsigned(string.size());
+  bytes.append(string.begin(), string.end());
+}
+
+void ExpressionEncoder::write_kind(ExpressionKind kind) {
+  write_byte(static_cast<unsigned char>(kind));
+}
+
+void ExpressionEncoder::write_type(const Type *type) { type->encode(*this); }
+
+void ExpressionEncoder::write_expression(const Expression *expression) {
+  auto found = indices.find(expression);
+  if (found != indices.end()) {
+    write_byte(reference_opcode);
+    write_unsigned(found->second);
+    return;
+  }
+  expression->encode(*this);
+  indices.emplace(expression, indices.size());
+}
+
+// Reads what ExpressionEncoder writes, rebuilding each node through the
+// create_* functions so that it is interned in the arena like any other. The
+// input may come from anywhere, so every read is checked against its end, and
+// a node is only built once everything it is built from has been read.
+class ExpressionDecoder {
+  ExpressionArena *arena;
+  const unsigned char *position;
+  const unsigned char *end;
+  // Set once the input has turned out truncated or malformed. Reads return
+  // zeros from then on.
+  bool is_malformed;
+  llvm::SmallVector<Expression *, 16> stack;
+  llvm::SmallVector<Expression *, 16> definitions;
+  // What pop takes off the stack.
+  llvm::SmallVector<Expression *, 16> operands;
+
+  unsigned char read_byte() {
+    if (position == end) {
+      is_malformed = true;
+      return 0;
+    }
+    return *position++;
+  }
+
+  std::uint64_t read_unsigned() {
+    std::uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      unsigned char byte = read_byte();
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    // Longer than any 64-bit value.
+    is_malformed = true;
+    return 0;
+  }
+
+  std::int64_t read_signed() {
+    std::uint64_t value = read_unsigned();
+    return static_cast<std::int64_t>(value >> 1) ^
+           -static_cast<std::int64_t>(value & 1);
+  }
+
+  llvm::StringRef read_string() {
+    std::size_t size = read_unsigned();
+    if (size > static_cast<std::size_t>(end - position)) {
+      is_malformed = true;
+      return {};
+    }
+    llvm::StringRef string(reinterpret_cast<const char *>(position), size);
+    position += size;
+    return string;
+  }
+
+  // A string written with its terminator, as a C string.
+  llvm::StringRef read_name() {
+    llvm::StringRef name = read_string();
+    if (name.empty() || name.back() != '\0') {
+      is_malformed = true;
+      return {};
+    }
+    return name;
+  }
+
+  Type *read_scalar_type(unsigned char tag) {
+    switch (static_cast<TypeTag>(tag)) {
+    case TypeTag::Boolean:
+      return get_boolean_type();
+    case TypeTag::Integer:
+      return get_integer_type();
+    case TypeTag::Size:
+      return get_size_type();
+    case TypeTag::String:
+      return get_string_type();
+    case TypeTag::Float:
+      return get_float_type();
+    case TypeTag::Double:
+      return get_double_type();
+    case TypeTag::Vector:
+      break;
+    }
+    is_malformed = true;
+    return nullptr;
+  }
+
+  // What follows the tag of a vector type, of at most `max_num_elements`
+  // elements. Vectors are only of scalars, so this does not recurse. Types are
+  // never freed, so the width is checked before one is created.
+  VectorType *read_vector_type(std::size_t max_num_elements) {
+    Type *element_type = read_scalar_type(read_byte());
+    std::size_t num_elements = read_unsigned();
+    if (element_type == get_string_type() || num_elements == 0 ||
+        num_elements > max_num_elements) {
+      is_malformed = true;
+    }
+    if (is_malformed) {
+      return nullptr;
+    }
+    return get_vector_type(element_type, num_elements);
+  }
+
+  // Null if malformed.
+  Type *read_type() {
+    unsigned char tag = read_byte();
+    if (static_cast<TypeTag>(tag) == TypeTag::Vector) {
+      // LLVM counts the elements of a vector type in 32 bits.
+      return read_vector_type(UINT32_MAX);
+    }
+    return read_scalar_type(tag);
+  }
+
+  void read_types(llvm::SmallVectorImpl<Type *> &types) {
+    std::size_t num_types = read_unsigned();
+    for (std::size_t type_index = 0; type_index < num_types && !is_malformed;
+         type_index++) {
+      types.push_back(read_type());
+    }
+  }
+
+  // Takes the last `count` decoded expressions off the stack, in order. They
+  // stay valid until the next pop. Null if there are fewer, or if anything
+  // read before was malformed, so that a null check guards the whole node.
+  Expression **pop(std::size_t count) {
+    if (is_malformed || count > stack.size()) {
+      is_malformed = true;
+      return nullptr;
+    }
+    operands.assign(stack.end() - count, stack.end());
+    stack.resize(stack.size() - count);
+    return operands.data();
+  }
+
+  // Null if malformed.
+  Expression *read_expression(unsigned char opcode) {
+    switch (static_cast<ExpressionKind>(opcode)) {
+    case ExpressionKind::Parameter:
+      return create_parameter(arena, read_signed());
+    case ExpressionKind::Boolean:
+      return create_boolean(arena, read_byte());
+    case ExpressionKind::Integer:
+      return create_integer(arena, read_signed());
+    case ExpressionKind::AddInteger: {
+      Expression **operands = pop(2);
+      if (!operands) {
+        return nullptr;
+      }
+      return create_add_integer(arena, operands[0], operands[1]);
+    }
+    case ExpressionKind::Float: {
+      auto bits = static_cast<std::uint32_t>(read_unsigned());
+      return create_float(arena, llvm::bit_cast<float>(bits));
+    }
+    case ExpressionKind::Double:
+      return create_double(arena, llvm::bit_cast<double>(read_unsigned()));
+    case ExpressionKind::FloatOperation: {
+      unsigned char op = read_byte();
+      bool is_fast = read_byte();
+      if (op > static_cast<unsigned char>(FloatOperator::Divide)) {
+        is_malformed = true;
+      }
+      Expression **operands = pop(2);
+      if (!operands) {
+        return nullptr;
+      }
+      return intern(arena, FloatOperation(static_cast<FloatOperator>(op),
+                                          operands[0], operands[1], is_fast));
+    }
+    case ExpressionKind::Vector: {
+      if (static_cast<TypeTag>(read_byte()) != TypeTag::Vector) {
+        is_malformed = true;
+      }
+      // The elements are on the stack already.
+      VectorType *type = read_vector_type(stack.size());
+      if (!type) {
+        return nullptr;
+      }
+      Expression **operands = pop(type->num_elements);
+      if (!operands) {
+        return nullptr;
+      }
+      return create_vector(arena, type, operands);
+    }
+    case ExpressionKind::ExtractElement: {
+      Expression **operands = pop(2);
+      if (!operands) {
+        return nullptr;
+      }
+      return create_extract_element(arena, operands[0], operands[1]);
+    }
+    case ExpressionKind::Size:
+      return create_size(arena, read_unsigned());
+    case ExpressionKind::String: {
+      llvm::StringRef string = read_string();
+      if (is_malformed) {
+        return nullptr;
+      }
+      string = get_decoded_string(string);
+      return create_string(arena, string.size(), string.data());
+    }
+    case ExpressionKind::Print: {
+      Expression **operands = pop(1);
+      if (!operands) {
+        return nullptr;
+      }
+      return create_print(arena, operands[0]);
+    }
+    case ExpressionKind::Array: {
+      Type *type = read_type();
+      std::size_t num_elements = read_unsigned();
+      Expression **operands = pop(num_elements);
+      if (!operands) {
+        return nullptr;
+      }
+      return create_array(arena, type, num_elements, operands);
+    }
+    case ExpressionKind::Function: {
+      llvm::StringRef name = read_name();
+      Type *return_type = read_type();
+      llvm::SmallVector<Type *, 8> parameters_type;
+      read_types(parameters_type);
+      bool is_variadic = read_byte();
+      if (is_malformed) {
+        return nullptr;
+      }
+      // Unlike create_function, the name is copied into the arena, since the
+      // encoding need not outlive the expression.
+      Function key(name.data(), return_type, parameters_type, is_variadic);
+      return arena->intern(key, [&] {
+        return arena->create<Function>(
+            arena->copy(llvm::ArrayRef<char>(name.data(), name.size())).data(),
+            return_type, arena->copy(llvm::ArrayRef<Type *>(parameters_type)),
+            is_variadic);
+      });
+    }
+    case ExpressionKind::ReadyMade: {
+      llvm::StringRef name = read_name();
+      if (is_malformed) {
+        return nullptr;
+      }
+      // Ready-made functions are never freed, so the encoding may only name
+      // one that exists already.
+      ReadyMade *ready_made = find_ready_made(name.data());
+      if (!ready_made) {
+        is_malformed = true;
+      }
+      return ready_made;
+    }
+    case ExpressionKind::Call: {
+      Type *return_type = read_type();
+      llvm::SmallVector<Type *, 8> parameters_type;
+      read_types(parameters_type);
+      bool is_variadic = read_byte();
+      std::size_t num_arguments = read_unsigned();
+      // Only a variadic callee takes more arguments than it has parameters.
+      if (num_arguments >= stack.size() ||
+          num_arguments < parameters_type.size() ||
+          (!is_variadic && num_arguments != parameters_type.size())) {
+        is_malformed = true;
+      }
+      Expression **operands = pop(num_arguments + 1);
+      if (!operands) {
+        return nullptr;
+      }
+      return intern_call(arena, operands[0], return_type, parameters_type,
+                         is_variadic,
+                         llvm::ArrayRef<Expression *>(operands + 1,
+                                                      num_arguments));
+    }
+    case ExpressionKind::Bytecode: {
+      llvm::StringRef data = read_string();
+      if (is_malformed) {
+        return nullptr;
+      }
+      return create_bytecode(arena, data.size(), data.data());
+    }
+    }
+    is_malformed = true;
+    return nullptr;
+  }
+
+public:
+  ExpressionDecoder(ExpressionArena *arena) : arena(arena) {}
+
+  // Null if the input is truncated, malformed, or does not leave exactly one
+  // expression.
+  Expression *decode(const char *data, std::size_t size) {
+    position = reinterpret_cast<const unsigned char *>(data);
+    end = position + size;
+    is_malformed = false;
+    while (position < end) {
+      unsigned char opcode = read_byte();
+      if (opcode == reference_opcode) {
+        std::uint64_t index = read_unsigned();
+        if (is_malformed || index >= definitions.size()) {
+          return nullptr;
+        }
+        stack.push_back(definitions[index]);
+        continue;
+      }
+      Expression *expression = read_expression(opcode);
+      if (!expression || is_malformed) {
+        return nullptr;
+      }
+      stack.push_back(expression);
+      definitions.push_back(expression);
+    }
+    return stack.size() == 1 ? stack.back() : nullptr;
+  }
+};
+
+extern "C" std::size_t encode_expression(Expression *expression, char *buffer,
+                                         std::size_t capacity) {
+  ExpressionEncoder encoder;
+  encoder.write_expression(expression);
+  if (encoder.bytes.size() <= capacity) {
+    std::memcpy(buffer, encoder.bytes.data(), encoder.bytes.size());
+  }
+  return encoder.bytes.size();
+}
+
+extern "C" Expression *decode_expression(ExpressionArena *arena,
+                                         const char *data, std::size_t size) {
+  return ExpressionDecoder(arena).decode(data, size);
+}
+
+extern "C" Expression *to_constructor(ExpressionArena *arena,
+                                      Expression *expression) {
+  ExpressionEncoder encoder;
+  encoder.write_expression(expression);
+  return create_constructor_call(
+      *arena, "decode_expression", {get_size_type(), get_size_type()},
+      {create_bytecode(arena, encoder.bytes.size(), encoder.bytes.data()),
+       arena->create<Size>(encoder.bytes.size())});
+}
+
+extern "C" Expression *to_constructor_tree(ExpressionArena *arena,
+                                           Expression *expression) {
+  return expression->to_constructor(*arena);
+}
+
+Parameter::Parameter(int index) : index(index) {
+  hash = llvm::hash_combine(ExpressionKind::Parameter, index);
+}
+
+llvm::Value *Parameter::codegen(llvm::IRBuilderBase &builder) const {
+  return builder.GetInsertBlock()->getParent()->getArg(index);
+}
+
+void Parameter::debug_print(std::ostream &os) const {
+  os << "Parameter " << index;
+}
+
+Expression *Parameter::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_parameter",
+                                 {get_integer_type()},
+                                 {arena.create<Integer>(index)});
+}
+
+void Parameter::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Parameter);
+  encoder.write_signed(index);
+}
+
+Expression *Parameter::simplify(Simplifier &simplifier) {
+  if (simplifier.inlining_depth == 0) {
+    return this;
+  }
+  if (index < 0 ||
+      static_cast<std::size_t>(index) >= simplifier.arguments.size()) {
+    simplifier.has_unbound_parameter = true;
+    return this;
+  }
+  return simplifier.arguments[index];
+}
+
+bool Parameter::can_evaluate() const { return true; }
+
+RuntimeValue Parameter::evaluate(Interpreter &interpreter) const {
+  return interpreter.arguments[index];
+}
+
+ExpressionKind Parameter::kind() const { return ExpressionKind::Parameter; }
+
+bool Parameter::equals(const Expression *other) const {
+  return index == static_cast<const Parameter *>(other)->index;
+}
+
+extern "C" Parameter *create_parameter(ExpressionArena *arena, int index) {
+  return intern(arena, Parameter(index));
+}
+
+Boolean::Boolean(bool value) : value(value) {
+  hash = llvm::hash_combine(ExpressionKind::Boolean, value);
+}
+
+llvm::Value *Boolean::codegen(llvm::IRBuilderBase &builder) const {
+  return builder.getInt1(value);
+}
+
+void Boolean::debug_print(std::ostream &os) const { os << "Boolean " << value; }
+
+Expression *Boolean::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_boolean", {get_boolean_type()},
+                                 {arena.create<Boolean>(value)});
+}
+
+void Boolean::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Boolean);
+  encoder.write_byte(value);
+}
+
+Expression *Boolean::simplify(Simplifier &) { return this; }
+
+bool Boolean::can_evaluate() const { return true; }
+
+RuntimeValue Boolean::evaluate(Interpreter &) const {
+  RuntimeValue result;
+  result.boolean = value;
+  return result;
+}
+
+ExpressionKind Boolean::kind() const { return ExpressionKind::Boolean; }
+
+bool Boolean::equals(const Expression *other) const {
+  return value == static_cast<const Boolean *>(other)->value;
+}
+
+extern "C" Boolean *create_boolean(ExpressionArena *arena, bool value) {
+  return intern(arena, Boolean(value));
+}
+
+Integer::Integer(int value) : value(value) {
+  hash = llvm::hash_combine(ExpressionKind::Integer, value);
+}
+
+llvm::Value *Integer::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Type *integer_type =
+      get_integer_type()->into_llvm_type(builder.getContext());
+  return llvm::ConstantInt::get(integer_type, value);
+}
+
+void Integer::debug_print(std::ostream &os) const { os << "Integer " << value; }
+
+Expression *Integer::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_integer", {get_integer_type()},
+                                 {arena.create<Integer>(value)});
+}
+
+void Integer::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Integer);
+  encoder.write_signed(value);
+}
+
+Expression *Integer::simplify(Simplifier &) { return this; }
+
+bool Integer::can_evaluate() const { return true; }
+
+RuntimeValue Integer::evaluate(Interpreter &) const {
+  RuntimeValue result;
+  result.integer = value;
+  return result;
+}
+
+ExpressionKind Integer::kind() const { return ExpressionKind::Integer; }
+
+bool Integer::equals(const Expression *other) const {
+  return value == static_cast<const Integer *>(other)->value;
+}
+
+extern "C" Integer *create_integer(ExpressionArena *arena, int value) {
+  return intern(arena, Integer(value));
+}
+
+AddInteger::AddInteger(Expression *left, Expression *right)
+    : left(left), right(right) {
+  hash =
+      llvm::hash_combine(ExpressionKind::AddInteger, left->hash, right->hash);
+}
+
+llvm::Value *AddInteger::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Value *llvm_left = left->codegen(builder);
+  llvm::Value *llvm_right = right->codegen(builder);
+  return builder.CreateAdd(llvm_left, llvm_right);
+}
+
+void AddInteger::debug_print(std::ostream &os) const {
+  os << "AddInteger(";
+  left->debug_print(os);
+  os << ", ";
+  right->debug_print(os);
+  os << ")";
+}
+
+Expression *AddInteger::to_constructor(ExpressionArena &arena) const {
+  Expression *left_constructor = left->to_constructor(arena);
+  Expression *right_constructor = right->to_constructor(arena);
+  return create_constructor_call(arena, "create_add_integer",
+                                 {get_size_type(), get_size_type()},
+                                 {left_constructor, right_constructor});
+}
+
+void AddInteger::encode(ExpressionEncoder &encoder) const {
+  encoder.write_expression(left);
+  encoder.write_expression(right);
+  encoder.write_kind(ExpressionKind::AddInteger);
+}
+
+Expression *AddInteger::simplify(Simplifier &simplifier) {
+  Expression *simplified_left = left->simplify(simplifier);
+  Expression *simplified_right = right->simplify(simplifier);
+  if (is_integer(simplified_left) && is_integer(simplified_right)) {
+    // Wraps around like the generated `add`.
+    unsigned sum = static_cast<unsigned>(get_integer(simplified_left)) +
+                   static_cast<unsigned>(get_integer(simplified_right));
+    return create_integer(&simplifier.arena, static_cast<int>(sum));
+  }
+  if (is_integer(simplified_left) && get_integer(simplified_left) == 0) {
+    return simplified_right;
+  }
+  if (is_integer(simplified_right) && get_integer(simplified_right) == 0) {
+    return simplified_left;
+  }
+  if (simplified_left == left && simplified_right == right) {
+    return this;
+  }
+  return create_add_integer(&simplifier.arena, simplified_left,
+                            simplified_right);
+}
+
+bool AddInteger::can_evaluate() const {
+  return left->can_evaluate() && right->can_evaluate();
+}
+
+// Whether the expression evaluates to a size rather than an int, as the
+// operands of an AddInteger may.
+static bool is_size_valued(const Expression *expression,
+                           const Interpreter &interpreter) {
+  switch (expression->kind()) {
+  case ExpressionKind::Parameter:
+    return interpreter.parameters_type[static_cast<const Parameter *>(
+                                           expression)
+                                           ->get_index()] == get_size_type();
+  case ExpressionKind::AddInteger:
+    return is_size_valued(
+        static_cast<const AddInteger *>(expression)->get_left(), interpreter);
+  case ExpressionKind::Call:
+    return static_cast<const Call *>(expression)->get_return_type() ==
+           get_size_type();
+  case ExpressionKind::Size:
+  case ExpressionKind::Array:
+  case ExpressionKind::Function:
+  case ExpressionKind::ReadyMade:
+  case ExpressionKind::Bytecode:
+    return true;
+  default:
+    return false;
+  }
+}
+
+RuntimeValue AddInteger::evaluate(Interpreter &interpreter) const {
+  RuntimeValue left_value = left->evaluate(interpreter);
+  RuntimeValue right_value = right->evaluate(interpreter);
+  RuntimeValue result;
+  if (is_size_valued(left, interpreter)) {
+    result.size = left_value.size + right_value.size;
+  } else {
+    unsigned sum = static_cast<unsigned>(left_value.integer) +
+                   static_cast<unsigned>(right_value.integer);
+    result.integer = static_cast<int>(sum);
+  }
+  return result;
+}
+
+ExpressionKind AddInteger::kind() const { return ExpressionKind::AddInteger; }
+
+bool AddInteger::equals(const Expression *other) const {
+  auto other_add_integer = static_cast<const AddInteger *>(other);
+  return is_equal(left, other_add_integer->left) &&
+         is_equal(right, other_add_integer->right);
+}
+
+extern "C" AddInteger *create_add_integer(ExpressionArena *arena,
+                                          Expression *left,
+                                          Expression *right) {
+  return intern(arena, AddInteger(left, right));
+}
+
+Float::Float(float value) : value(value) {
+  hash = llvm::hash_combine(ExpressionKind::Float,
+                            llvm::bit_cast<std::uint32_t>(value));
+}
+
+llvm::Value *Float::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Type *float_type =
+      get_float_type()->into_llvm_type(builder.getContext());
+  return llvm::ConstantFP::get(float_type, value);
+}
+
+void Float::debug_print(std::ostream &os) const { os << "Float " << value; }
+
+Expression *Float::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_float", {get_float_type()},
+                                 {arena.create<Float>(value)});
+}
+
+void Float::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Float);
+  encoder.write_unsigned(llvm::bit_cast<std::uint32_t>(value));
+}
+
+Expression *Float::simplify(Simplifier &) { return this; }
+
+bool Float::can_evaluate() const { return true; }
+
+RuntimeValue Float::evaluate(Interpreter &) const {
+  RuntimeValue result;
+  result.float_value = value;
+  return result;
+}
+
+ExpressionKind Float::kind() const { return ExpressionKind::Float; }
+
+// Constants compare by representation, so that NaN equals itself and 0.0
+// differs from -0.0.
+bool Float::equals(const Expression *other) const {
+  return llvm::bit_cast<std::uint32_t>(value) ==
+         llvm::bit_cast<std::uint32_t>(
+             static_cast<const Float *>(other)->value);
+}
+
+extern "C" Float *create_float(ExpressionArena *arena, float value) {
+  return intern(arena, Float(value));
+}
+
+Double::Double(double value) : value(value) {
+  hash = llvm::hash_combine(ExpressionKind::Double,
+                            llvm::bit_cast<std::uint64_t>(value));
+}
+
+llvm::Value *Double::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Type *double_type =
+      get_double_type()->into_llvm_type(builder.getContext());
+  return llvm::ConstantFP::get(double_type, value);
+}
+
+void Double::debug_print(std::ostream &os) const { os << "Double " << value; }
+
+Expression *Double::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_double", {get_double_type()},
+                                 {arena.create<Double>(value)});
+}
+
+void Double::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Double);
+  encoder.write_unsigned(llvm::bit_cast<std::uint64_t>(value));
+}
+
+Expression *Double::simplify(Simplifier &) { return this; }
+
+bool Double::can_evaluate() const { return true; }
+
+RuntimeValue Double::evaluate(Interpreter &) const {
+  RuntimeValue result;
+  result.double_value = value;
+  return result;
+}
+
+ExpressionKind Double::kind() const { return ExpressionKind::Double; }
+
+bool Double::equals(const Expression *other) const {
+  return llvm::bit_cast<std::uint64_t>(value) ==
+         llvm::bit_cast<std::uint64_t>(
+             static_cast<const Double *>(other)->value);
+}
+
+extern "C" Double *create_double(ExpressionArena *arena, double value) {
+  return intern(arena, Double(value));
+}
+
+FloatOperation::FloatOperation(FloatOperator op, Expression *left,
+                               Expression *right, bool is_fast)
+    : op(op), left(left), right(right), is_fast(is_fast) {
+  hash = llvm::hash_combine(ExpressionKind::FloatOperation, op, left->hash,
+                            right->hash, is_fast);
+}
+
+static llvm::Instruction::BinaryOps get_opcode(FloatOperator op) {
+  switch (op) {
+  case FloatOperator::Add:
+    return llvm::Instruction::FAdd;
+  case FloatOperator::Subtract:
+    return llvm::Instruction::FSub;
+  case FloatOperator::Multiply:
+    return llvm::Instruction::FMul;
+  case FloatOperator::Divide:
+    return llvm::Instruction::FDiv;
+  }
+  llvm_unreachable("unknown float operator");
+}
+
+static const char *get_name(FloatOperator op) {
+  switch (op) {
+  case FloatOperator::Add:
+    return "AddFloat";
+  case FloatOperator::Subtract:
+    return "SubtractFloat";
+  case FloatOperator::Multiply:
+    return "MultiplyFloat";
+  case FloatOperator::Divide:
+    return "DivideFloat";
+  }
+  llvm_unreachable("unknown float operator");
+}
+
+static const char *get_constructor_name(FloatOperator op) {
+  switch (op) {
+  case FloatOperator::Add:
+    return "create_add_float";
+  case FloatOperator::Subtract:
+    return "create_subtract_float";
+  case FloatOperator::Multiply:
+    return "create_multiply_float";
+  case FloatOperator::Divide:
+    return "create_divide_float";
+  }
+  llvm_unreachable("unknown float operator");
+}
+
+llvm::Value *FloatOperation::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Value *llvm_left = left->codegen(builder);
+  llvm::Value *llvm_right = right->codegen(builder);
+  llvm::IRBuilderBase::FastMathFlagGuard guard(builder);
+  if (is_fast) {
+    llvm::FastMathFlags flags;
+    flags.setFast();
+    builder.setFastMathFlags(flags);
+  }
+  return builder.CreateBinOp(get_opcode(op), llvm_left, llvm_right);
+}
+
+void FloatOperation::debug_print(std::ostream &os) const {
+  os << get_name(op) << (is_fast ? " fast(" : "(");
+  left->debug_print(os);
+  os << ", ";
+  right->debug_print(os);
+  os << ")";
+}
+
+Expression *FloatOperation::to_constructor(ExpressionArena &arena) const {
+  Expression *left_constructor = left->to_constructor(arena);
+  Expression *right_constructor = right->to_constructor(arena);
+  return create_constructor_call(
+      arena, get_constructor_name(op),
+      {get_size_type(), get_size_type(), get_boolean_type()},
+      {left_constructor, right_constructor, arena.create<Boolean>(is_fast)});
+}
+
+void FloatOperation::encode(ExpressionEncoder &encoder) const {
+  encoder.write_expression(left);
+  encoder.write_expression(right);
+  encoder.write_kind(ExpressionKind::FloatOperation);
+  encoder.write_byte(static_cast<unsigned char>(op));
+  encoder.write_byte(is_fast);
+}
+
+template <typename T>
+static T apply_float_operator(FloatOperator op, T left, T right) {
+  switch (op) {
+  case FloatOperator::Add:
+    return left + right;
+  case FloatOperator::Subtract:
+    return left - right;
+  case FloatOperator::Multiply:
+    return left * right;
+  case FloatOperator::Divide:
+    return left / right;
+  }
+  llvm_unreachable("unknown float operator");
+}
+
+// Only operations on two constants are folded; identities such as x + 0.0 do
+// not hold for every x.
+Expression *FloatOperation::simplify(Simplifier &simplifier) {
+  Expression *simplified_left = left->simplify(simplifier);
+  Expression *simplified_right = right->simplify(simplifier);
+  ExpressionKind left_kind = simplified_left->kind();
+  if (left_kind == simplified_right->kind()) {
+    if (left_kind == ExpressionKind::Float) {
+      return create_float(
+          &simplifier.arena,
+          apply_float_operator(
+              op, static_cast<Float *>(simplified_left)->get_value(),
+              static_cast<Float *>(simplified_right)->get_value()));
+    }
+    if (left_kind == ExpressionKind::Double) {
+      return create_double(
+          &simplifier.arena,
+          apply_float_operator(
+              op, static_cast<Double *>(simplified_left)->get_value(),
+              static_cast<Double *>(simplified_right)->get_value()));
+    }
+  }
+  if (simplified_left == left && simplified_right == right) {
+    return this;
+  }
+  return intern(&simplifier.arena, FloatOperation(op, simplified_left,
+                                                  simplified_right, is_fast));
+}
+
+bool FloatOperation::can_evaluate() const { return false; }
+
+RuntimeValue FloatOperation::evaluate(Interpreter &) const {
+  llvm_unreachable("float operations are not interpreted");
+}
+
+ExpressionKind FloatOperation::kind() const {
+  return ExpressionKind::FloatOperation;
+}
+
+bool FloatOperation::equals(const Expression *other) const {
+  auto other_operation = static_cast<const FloatOperation *>(other);
+  return op == other_operation->op && is_fast == other_operation->is_fast &&
+         is_equal(left, other_operation->left) &&
+         is_equal(right, other_operation->right);
+}
+
+extern "C" FloatOperation *create_add_float(ExpressionArena *arena,
+                                            Expression *left,
+                                            Expression *right, bool is_fast) {
+  return intern(arena,
+                FloatOperation(FloatOperator::Add, left, right, is_fast));
+}
+
+extern "C" FloatOperation *create_subtract_float(ExpressionArena *arena,
+                                                 Expression *left,
+                                                 Expression *right,
+                                                 bool is_fast) {
+  return intern(arena,
+                FloatOperation(FloatOperator::Subtract, left, right, is_fast));
+}
+
+extern "C" FloatOperation *create_multiply_float(ExpressionArena *arena,
+                                                 Expression *left,
+                                                 Expression *right,
+                                                 bool is_fast) {
+  return intern(arena,
+                FloatOperation(FloatOperator::Multiply, left, right, is_fast));
+}
+
+extern "C" FloatOperation *create_divide_float(ExpressionArena *arena,
+                                               Expression *left,
+                                               Expression *right,
+                                               bool is_fast) {
+  return intern(arena,
+                FloatOperation(FloatOperator::Divide, left, right, is_fast));
+}
+
+Vector::Vector(VectorType *type, llvm::ArrayRef<Expression *> elements)
+    : type(type), elements(elements) {
+  hash = llvm::hash_combine(ExpressionKind::Vector, type,
+                            hash_expressions(elements));
+}
+
+llvm::Value *Vector::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Value *vector =
+      llvm::PoisonValue::get(type->into_llvm_type(builder.getContext()));
+  for (std::size_t element_index = 0; element_index < elements.size();
+       element_index++) {
+    llvm::Value *element = elements[element_index]->codegen(builder);
+    vector = builder.CreateInsertElement(vector, element, element_index);
+  }
+  return vector;
+}
+
+void Vector::debug_print(std::ostream &os) const {
+  os << "Vector(";
+  for (std::size_t element_index = 0; element_index < elements.size();
+       element_index++) {
+    elements[element_index]->debug_print(os);
+    if (element_index < elements.size() - 1) {
+      os << ", ";
+    }
+  }
+  os << ")";
+}
+
+Expression *Vector::to_constructor(ExpressionArena &arena) const {
+  std::vector<Expression *> elements_constructor;
+  for (Expression *element : elements) {
+    elements_constructor.push_back(element->to_constructor(arena));
+  }
+  return create_constructor_call(
+      arena, "create_vector", {get_size_type(), get_size_type()},
+      {
+          arena.create<Size>(reinterpret_cast<std::size_t>(type)),
+          arena.create<Array>(get_size_type(),
+                              arena.copy<Expression *>(elements_constructor)),
+      });
+}
+
+void Vector::encode(ExpressionEncoder &encoder) const {
+  for (Expression *element : elements) {
+    encoder.write_expression(element);
+  }
+  encoder.write_kind(ExpressionKind::Vector);
+  encoder.write_type(type);
+}
+
+Expression *Vector::simplify(Simplifier &simplifier) {
+  llvm::SmallVector<Expression *, 8> simplified_elements;
+  if (!simplify_expressions(simplifier, elements, simplified_elements)) {
+    return this;
+  }
+  return create_vector(&simplifier.arena, type, simplified_elements.data());
+}
+
+bool Vector::can_evaluate() const { return false; }
+
+RuntimeValue Vector::evaluate(Interpreter &) const {
+  llvm_unreachable("vectors are not interpreted");
+}
+
+ExpressionKind Vector::kind() const { return ExpressionKind::Vector; }
+
+bool Vector::equals(const Expression *other) const {
+  auto other_vector = static_cast<const Vector *>(other);
+  return type == other_vector->type &&
+         is_equal(elements, other_vector->elements);
+}
+
+extern "C" Vector *create_vector(ExpressionArena *arena, VectorType *type,
+                                 Expression **elements) {
+  llvm::ArrayRef<Expression *> key_elements(elements, type->num_elements);
+  Vector key(type, key_elements);
+  return static_cast<Vector *>(arena->intern(key, [&] {
+    return arena->create<Vector>(type, arena->copy(key_elements));
+  }));
+}
+
+ExtractElement::ExtractElement(Expression *vector, Expression *index)
+    : vector(vector), index(index) {
+  hash = llvm::hash_combine(ExpressionKind::ExtractElement, vector->hash,
+                            index->hash);
+}
+
+llvm::Value *ExtractElement::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Value *llvm_vector = vector->codegen(builder);
+  llvm::Value *llvm_index = index->codegen(builder);
+  return builder.CreateExtractElement(llvm_vector, llvm_index);
+}
+
+void ExtractElement::debug_print(std::ostream &os) const {
+  os << "ExtractElement(";
+  vector->debug_print(os);
+  os << ", ";
+  index->debug_print(os);
+  os << ")";
+}
+
+Expression *ExtractElement::to_constructor(ExpressionArena &arena) const {
+  Expression *vector_constructor = vector->to_constructor(arena);
+  Expression *index_constructor = index->to_constructor(arena);
+  return create_constructor_call(arena, "create_extract_element",
+                                 {get_size_type(), get_size_type()},
+                                 {vector_constructor, index_constructor});
+}
+
+void ExtractElement::encode(ExpressionEncoder &encoder) const {
+  encoder.write_expression(vector);
+  encoder.write_expression(index);
+  encoder.write_kind(ExpressionKind::ExtractElement);
+}
+
+Expression *ExtractElement::simplify(Simplifier &simplifier) {
+  Expression *simplified_vector = vector->simplify(simplifier);
+  Expression *simplified_index = index->simplify(simplifier);
+  if (simplified_vector->kind() == ExpressionKind::Vector) {
+    llvm::ArrayRef<Expression *> elements =
+        static_cast<Vector *>(simplified_vector)->get_elements();
+    std::optional<std::size_t> constant_index;
+    if (simplified_index->kind() == ExpressionKind::Size) {
+      constant_index = static_cast<Size *>(simplified_index)->get_value();
+    } else if (is_integer(simplified_index)) {
+      constant_index = static_cast<unsigned>(get_integer(simplified_index));
+    }
+    if (constant_index && *constant_index < elements.size()) {
+      // The other elements are dropped, so they must have no effects.
+      bool is_foldable = true;
+      for (std::size_t element_index = 0; element_index < elements.size();
+           element_index++) {
+        is_foldable &= element_index == *constant_index ||
+                       is_value(elements[element_index]);
+      }
+      if (is_foldable) {
+        return elements[*constant_index];
+      }
+    }
+  }
+  if (simplified_vector == vector && simplified_index == index) {
+    return this;
+  }
+  return create_extract_element(&simplifier.arena, simplified_vector,
+                                simplified_index);
+}
+
+bool ExtractElement::can_evaluate() const { return false; }
+
+RuntimeValue ExtractElement::evaluate(Interpreter &) const {
+  llvm_unreachable("vectors are not interpreted");
+}
+
+ExpressionKind ExtractElement::kind() const {
+  return ExpressionKind::ExtractElement;
+}
+
+bool ExtractElement::equals(const Expression *other) const {
+  auto other_extract_element = static_cast<const ExtractElement *>(other);
+  return is_equal(vector, other_extract_element->vector) &&
+         is_equal(index, other_extract_element->index);
+}
+
+extern "C" ExtractElement *create_extract_element(ExpressionArena *arena,
+                                                  Expression *vector,
+                                                  Expression *index) {
+  return intern(arena, ExtractElement(vector, index));
+}
+
+Size::Size(std::size_t value) : value(value) {
+  hash = llvm::hash_combine(ExpressionKind::Size, value);
+}
+
+llvm::Value *Size::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Type *type = get_size_type()->into_llvm_type(builder.getContext());
+  return llvm::ConstantInt::get(type, value);
+}
+
+void Size::debug_print(std::ostream &os) const { os << "Size " << value; }
+
+Expression *Size::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_size", {get_size_type()},
+                                 {arena.create<Size>(value)});
+}
+
+void Size::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Size);
+  encoder.write_unsigned(value);
+}
+
+Expression *Size::simplify(Simplifier &) { return this; }
+
+bool Size::can_evaluate() const { return true; }
+
+RuntimeValue Size::evaluate(Interpreter &) const { return make_size(value); }
+
+ExpressionKind Size::kind() const { return ExpressionKind::Size; }
+
+bool Size::equals(const Expression *other) const {
+  return value == static_cast<const Size *>(other)->value;
+}
+
+extern "C" Size *create_size(ExpressionArena *arena, std::size_t value) {
+  return intern(arena, Size(value));
+}
+
+String::String(std::size_t length, const char *pointer)
+    : length(length), pointer(pointer) {
+  hash = llvm::hash_combine(ExpressionKind::String, length, pointer);
+}
+
+llvm::Value *String::codegen(llvm::IRBuilderBase &builder) const {
+  exclude_from_object_cache(*builder.GetInsertBlock()->getModule());
+  llvm::Type *type = get_size_type()->into_llvm_type(builder.getContext());
+  return llvm::ConstantStruct::get(
+      llvm::StructType::get(type, type), llvm::ConstantInt::get(type, length),
+      llvm::ConstantInt::get(type, reinterpret_cast<std::size_t>(pointer)));
+}
+
+void String::debug_print(std::ostream &os) const {
+  os << "String \"" << std::string_view(pointer, length) << "\"";
+}
+
+Expression *String::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(
+      arena, "create_string", {get_size_type(), get_size_type()},
+      {arena.create<Size>(length),
+       arena.create<Size>(reinterpret_cast<std::size_t>(pointer))});
+}
+
+void String::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::String);
+  encoder.write_string(llvm::StringRef(pointer, length));
+}
+
+Expression *String::simplify(Simplifier &) { return this; }
+
+bool String::can_evaluate() const { return true; }
+
+RuntimeValue String::evaluate(Interpreter &) const {
+  RuntimeValue result;
+  result.string.length = length;
+  result.string.pointer = pointer;
+  return result;
+}
+
+ExpressionKind String::kind() const { return ExpressionKind::String; }
+
+// The generated code refers to the characters by address, so strings are only
+// equal when they share them.
+bool String::equals(const Expression *other) const {
+  auto other_string = static_cast<const String *>(other);
+  return length == other_string->length && pointer == other_string->pointer;
+}
+
+extern "C" String *create_string(ExpressionArena *arena, std::size_t length,
+                                 const char *pointer) {
+  return intern(arena, String(length, pointer));
+}
+
+Print::Print(Expression *string) : string(string) {
+  hash = llvm::hash_combine(ExpressionKind::Print, string->hash);
+}
+
+// Calls the runtime helper print_string, which the optimizer can inline down
+// to a call to fwrite, rather than printf, which would parse a format string
+// on every call.
+llvm::Value *Print::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Type *llvm_integer_type =
+      get_integer_type()->into_llvm_type(builder.getContext());
+  llvm::Type *llvm_size_type =
+      get_size_type()->into_llvm_type(builder.getContext());
+  llvm::Value *llvm_string = string->codegen(builder);
+  llvm::Value *length = builder.CreateExtractValue(llvm_string, {0});
+  llvm::Value *pointer = builder.CreateExtractValue(llvm_string, {1});
+
+  auto module = builder.GetInsertBlock()->getModule();
+  llvm::FunctionCallee print_string = module->getOrInsertFunction(
+      "print_string", llvm_integer_type, llvm_size_type, llvm_size_type);
+  return builder.CreateCall(print_string, {length, pointer});
+}
+
+void Print::debug_print(std::ostream &os) const {
+  os << "Print(";
+  string->debug_print(os);
+  os << ")";
+}
+
+Expression *Print::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_print", {get_size_type()},
+                                 {string->to_constructor(arena)});
+}
+
+void Print::encode(ExpressionEncoder &encoder) const {
+  encoder.write_expression(string);
+  encoder.write_kind(ExpressionKind::Print);
+}
+
+Expression *Print::simplify(Simplifier &simplifier) {
+  Expression *simplified_string = string->simplify(simplifier);
+  if (simplified_string == string) {
+    return this;
+  }
+  return create_print(&simplifier.arena, simplified_string);
+}
+
+bool Print::can_evaluate() const { return string->can_evaluate(); }
+
+RuntimeValue Print::evaluate(Interpreter &interpreter) const {
+  RuntimeValue value = string->evaluate(interpreter);
+  RuntimeValue result;
+  // As print_string does.
+  result.integer = static_cast<int>(
+      std::fwrite(value.string.pointer, 1, value.string.length, stdout));
+  return result;
+}
+
+ExpressionKind Print::kind() const { return ExpressionKind::Print; }
+
+bool Print::equals(const Expression *other) const {
+  return is_equal(string, static_cast<const Print *>(other)->string);
+}
+
+extern "C" Print *create_print(ExpressionArena *arena, Expression *string) {
+  return intern(arena, Print(string));
+}
+
+Array::Array(Type *type, llvm::ArrayRef<Expression *> elements)
+    : type(type), elements(elements) {
+  hash = llvm::hash_combine(ExpressionKind::Array, type,
+                            hash_expressions(elements));
+}
+
+llvm::Value *Array::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Type *element_type = type->into_llvm_type(builder.getContext());
+  llvm::ArrayType *array_type =
+      llvm::ArrayType::get(element_type, elements.size());
+  llvm::Type *llvm_size_type =
+      get_size_type()->into_llvm_type(builder.getContext());
+  std::vector<llvm::Value *> llvm_elements;
+  std::vector<llvm::Constant *> constant_elements;
+  for (Expression *element : elements) {
+    llvm::Value *llvm_element = element->codegen(builder);
+    llvm_elements.push_back(llvm_element);
+    if (auto constant = llvm::dyn_cast<llvm::Constant>(llvm_element)) {
+      constant_elements.push_back(constant);
+    }
+  }
+  // An array of constants, such as the type lists in constructor code, is
+  // emitted once as a global instead of being rebuilt on every execution.
+  if (constant_elements.size() == elements.size()) {
+    auto global = new llvm::GlobalVariable(
+        *builder.GetInsertBlock()->getModule(), array_type, true,
+        llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(array_type, constant_elements), "array");
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return builder.CreatePtrToInt(global, llvm_size_type);
+  }
+  // Otherwise the stack slot goes to the entry block, so that it is allocated
+  // once per call of the function however often the array is built.
+  llvm::BasicBlock &entry_block =
+      builder.GetInsertBlock()->getParent()->getEntryBlock();
+  llvm::IRBuilder<> entry_builder(&entry_block, entry_block.begin());
+  llvm::Value *array = entry_builder.CreateAlloca(array_type);
+  for (std::size_t element_index = 0; element_index < elements.size();
+       element_index++) {
+    llvm::Value *element_pointer =
+        builder.CreateConstGEP2_64(array_type, array, 0, element_index);
+    builder.CreateStore(llvm_elements[element_index], element_pointer);
+  }
+  // Arrays are passed around by address, as a size.
+  return builder.CreatePtrToInt(array, llvm_size_type);
+}
+
+void Array::debug_print(std::ostream &os) const {
+  os << "Array(";
+  for (std::size_t element_index = 0; element_index < elements.size();
+       element_index++) {
+    elements[element_index]->debug_print(os);
+    if (element_index < elements.size() - 1) {
+      os << ", ";
+    }
+  }
+  os << ")";
+}
+
+Expression *Array::to_constructor(ExpressionArena &arena) const {
+  std::vector<Expression *> elements_constructor;
+  for (Expression *element : elements) {
+    elements_constructor.push_back(element->to_constructor(arena));
+  }
+  return create_constructor_call(
+      arena, "create_array",
+      {get_size_type(), get_size_type(), get_size_type()},
+      {
+          arena.create<Size>(reinterpret_cast<std::size_t>(type)),
+          arena.create<Size>(elements.size()),
+          arena.create<Array>(get_size_type(),
+                              arena.copy<Expression *>(elements_constructor)),
+      });
+}
+
+void Array::encode(ExpressionEncoder &encoder) const {
+  for (Expression *element : elements) {
+    encoder.write_expression(element);
+  }
+  encoder.write_kind(ExpressionKind::Array);
+  encoder.write_type(type);
+  encoder.write_unsigned(elements.size());
+}
+
+Expression *Array::simplify(Simplifier &simplifier) {
+  llvm::SmallVector<Expression *, 8> simplified_elements;
+  if (!simplify_expressions(simplifier, elements, simplified_elements)) {
+    return this;
+  }
+  return create_array(&simplifier.arena, type, simplified_elements.size(),
+                      simplified_elements.data());
+}
+
+bool Array::can_evaluate() const {
+  return is_scalar(type) &&
+         llvm::all_of(elements, [](const Expression *element) {
+           return element->can_evaluate();
+         });
+}
+
+// The elements are laid out as in generated code, in memory that lives until
+// the outermost evaluation returns.
+RuntimeValue Array::evaluate(Interpreter &interpreter) const {
+  std::size_t element_size = get_value_size(type);
+  auto array = static_cast<char *>(interpreter.allocator.Allocate(
+      element_size * elements.size(), alignof(RuntimeValue)));
+  for (std::size_t element_index = 0; element_index < elements.size();
+       element_index++) {
+    RuntimeValue element = elements[element_index]->evaluate(interpreter);
+    std::memcpy(array + element_size * element_index, &element, element_size);
+  }
+  return make_size(reinterpret_cast<std::size_t>(array));
+}
+
+ExpressionKind Array::kind() const { return ExpressionKind::Array; }
+
+bool Array::equals(const Expression *other) const {
+  auto other_array = static_cast<const Array *>(other);
+  return type == other_array->type && is_equal(elements, other_array->elements);
+}
+
+extern "C" Array *create_array(ExpressionArena *arena, Type *type,
+                               std::size_t num_elements,
+                               Expression **elements) {
+  llvm::ArrayRef<Expression *> key_elements(elements, num_elements);
+  Array key(type, key_elements);
+  return static_cast<Array *>(arena->intern(key, [&] {
+    return arena->create<Array>(type, arena->copy(key_elements));
+  }));
+}
+
+Function::Function(const char *name, Type *return_type,
+                   llvm::ArrayRef<Type *> parameters_type, bool is_variadic)
+    : name(name), return_type(return_type), parameters_type(parameters_type),
+      is_variadic(is_variadic) {
+  hash = llvm::hash_combine(
+      ExpressionKind::Function, llvm::StringRef(name), return_type,
+      llvm::hash_combine_range(parameters_type.begin(), parameters_type.end()),
+      is_variadic);
+}
+
+// The address of the ReadyMade expression of the function named `name`. It is
+// referred to through its `ready_made.` absolute symbol rather than by its
+// address, so that the module is the same in every run and the object cache
+// can recognize it.
+static llvm::Value *build_ready_made_address(llvm::IRBuilderBase &builder,
+                                             const std::string &name) {
+  llvm::Type *llvm_size_type =
+      get_size_type()->into_llvm_type(builder.getContext());
+  auto module = builder.GetInsertBlock()->getModule();
+  llvm::Constant *ready_made = module->getOrInsertGlobal(
+      "ready_made." + name, llvm::Type::getInt8Ty(builder.getContext()));
+  return llvm::ConstantExpr::getPtrToInt(ready_made, llvm_size_type);
+}
+
+llvm::Value *Function::codegen(llvm::IRBuilderBase &builder) const {
+  get_ready_made(name);
+  return build_ready_made_address(builder, name);
+}
+
+void Function::debug_print(std::ostream &os) const {
+  os << "Function " << name;
+}
+
+Expression *Function::to_constructor(ExpressionArena &arena) const {
+  std::vector<Expression *> parameters_type_constructor;
+  for (Type *parameter_type : parameters_type) {
+    parameters_type_constructor.push_back(
+        arena.create<Size>(reinterpret_cast<std::size_t>(parameter_type)));
+  }
+  return create_constructor_call(
+      arena, "create_function",
+      {get_size_type(), get_size_type(), get_size_type(), get_size_type(),
+       get_boolean_type()},
+      {
+          arena.create<Size>(reinterpret_cast<std::size_t>(name)),
+          arena.create<Size>(reinterpret_cast<std::size_t>(return_type)),
+          arena.create<Size>(parameters_type.size()),
+          arena.create<Array>(
+              get_size_type(),
+              arena.copy<Expression *>(parameters_type_constructor)),
+          arena.create<Boolean>(is_variadic),
+      });
+}
+
+void Function::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Function);
+  // With the terminator, so that the decoded name is a C string.
+  encoder.write_string(llvm::StringRef(name, std::strlen(name) + 1));
+  encoder.write_type(return_type);
+  encoder.write_unsigned(parameters_type.size());
+  for (Type *parameter_type : parameters_type) {
+    encoder.write_type(parameter_type);
+  }
+  encoder.write_byte(is_variadic);
+}
+
+Expression *Function::simplify(Simplifier &) { return this; }
+
+bool Function::can_evaluate() const { return true; }
+
+RuntimeValue Function::evaluate(Interpreter &) const {
+  return make_size(reinterpret_cast<std::size_t>(get_ready_made(name)));
+}
+
+ExpressionKind Function::kind() const { return ExpressionKind::Function; }
+
+bool Function::equals(const Expression *other) const {
+  auto other_function = static_cast<const Function *>(other);
+  return std::strcmp(name, other_function->name) == 0 &&
+         return_type == other_function->return_type &&
+         parameters_type == other_function->parameters_type &&
+         is_variadic == other_function->is_variadic;
+}
+
+extern "C" Function *create_function(ExpressionArena *arena, const char *name,
+                                     Type *return_type,
+                                     std::size_t num_parameters,
+                                     Type **parameters_type, bool is_variadic) {
+  llvm::ArrayRef<Type *> key_parameters_type(parameters_type, num_parameters);
+  Function key(name, return_type, key_parameters_type, is_variadic);
+  return static_cast<Function *>(arena->intern(key, [&] {
+    return arena->create<Function>(name, return_type,
+                                   arena->copy(key_parameters_type),
+                                   is_variadic);
+  }));
+}
+
+ReadyMade::ReadyMade(std::string name) : name(std::move(name)) {
+  num_expression_allocations++;
+  hash = llvm::hash_combine(ExpressionKind::ReadyMade, this->name);
+}
+
+llvm::Value *ReadyMade::codegen(llvm::IRBuilderBase &builder) const {
+  return build_ready_made_address(builder, name);
+}
+
+void ReadyMade::debug_print(std::ostream &os) const {
+  os << "ReadyMade " << name;
+}
+
+Expression *ReadyMade::to_constructor(ExpressionArena &arena) const {
+  return arena.create<Size>(reinterpret_cast<std::size_t>(this));
+}
+
+// By name rather than by address, so that decoding can tell it from any other
+// number.
+void ReadyMade::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::ReadyMade);
+  encoder.write_string(llvm::StringRef(name.c_str(), name.size() + 1));
+}
+
+Expression *ReadyMade::simplify(Simplifier &) { return this; }
+
+bool ReadyMade::can_evaluate() const { return true; }
+
+RuntimeValue ReadyMade::evaluate(Interpreter &) const {
+  return make_size(reinterpret_cast<std::size_t>(this));
+}
+
+ExpressionKind ReadyMade::kind() const { return ExpressionKind::ReadyMade; }
+
+bool ReadyMade::equals(const Expression *other) const {
+  return name == static_cast<const ReadyMade *>(other)->name;
+}
+
+void ReadyMade::resolve() {
+  pointer = exit_on_error(jit->lookup(name)).toPtr<void *>();
+}
+
+Call::Call(Expression *function, Type *return_type,
+           llvm::ArrayRef<Type *> parameters_type, bool is_variadic,
+           llvm::ArrayRef<Expression *> arguments)
+    : function(function), return_type(return_type),
+      parameters_type(parameters_type), arguments(arguments),
+      is_variadic(is_variadic) {
+  hash = llvm::hash_combine(
+      ExpressionKind::Call, function->hash, return_type,
+      llvm::hash_combine_range(parameters_type.begin(), parameters_type.end()),
+      is_variadic, hash_expressions(arguments));
+}
+
+llvm::Value *Call::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Type *llvm_return_type =
+      return_type->into_llvm_type(builder.getContext());
+  std::vector<llvm::Type *> llvm_parameters_type;
+  for (auto &parameter_type : parameters_type) {
+    llvm_parameters_type.push_back(
+        parameter_type->into_llvm_type(builder.getContext()));
+  }
+  llvm::FunctionType *function_type = llvm::FunctionType::get(
+      llvm_return_type, llvm_parameters_type, is_variadic);
+
+  llvm::FunctionCallee callee;
+  if (function->kind() == ExpressionKind::Function) {
+    llvm::StringRef name = static_cast<Function *>(function)->get_name();
+    llvm::Module *module = builder.GetInsertBlock()->getModule();
+    if (name.starts_with("create_") || name == "decode_expression") {
+      // Constructor code passes the addresses of names, types and expressions.
+      exclude_from_object_cache(*module);
+      if (!arguments.empty() &&
+          arguments[0]->kind() == ExpressionKind::Size) {
+        add_arena_reference(
+            *module, static_cast<const Size *>(arguments[0])->get_value());
+      }
+    }
+    // A named function is called directly. The JIT resolves its symbol when
+    // linking, so there is no call site to resolve at run time.
+    callee = module->getOrInsertFunction(name, function_type);
+  } else if (is_variadic) {
+    // A resolver stub cannot forward variadic arguments, so variadic callees
+    // keep going through compile_expression on every call.
+    llvm::Value *llvm_function = function->codegen(builder);
+    callee = llvm::FunctionCallee(
+        function_type,
+        builder.CreateIntToPtr(
+            build_compile_expression_call(builder, llvm_function),
+            llvm::PointerType::getUnqual(function_type)));
+  } else {
+    llvm::Value *llvm_function = function->codegen(builder);
+    callee = llvm::FunctionCallee(
+        function_type,
+        build_call_site_lookup(builder, function_type, llvm_function));
+  }
+
+  std::vector<llvm::Value *> arguments_value;
+  for (auto &argument : arguments) {
+    arguments_value.push_back(argument->codegen(builder));
+  }
+  llvm::CallInst *call = builder.CreateCall(callee, arguments_value);
+  if (jit_options.profile_execution) {
+    // Marks the call for instrument_module among the runtime's own calls.
+    call->setMetadata("jit.call_site",
+                      llvm::MDNode::get(builder.getContext(), {}));
+  }
+  return call;
+}
+
+// Calls the runtime function `name` with `leading_arguments`, then the callee
+// and the signature of the call, all passed as sizes.
+llvm::Value *
+Call::build_runtime_call(llvm::IRBuilderBase &builder, llvm::StringRef name,
+                         llvm::ArrayRef<llvm::Value *> leading_arguments,
+                         llvm::Value *llvm_function) const {
+  llvm::Type *llvm_size_type =
+      get_size_type()->into_llvm_type(builder.getContext());
+  std::vector<llvm::Type *> runtime_parameters_type(
+      leading_arguments.size() + 4, llvm_size_type);
+  llvm::FunctionType *runtime_function_type =
+      llvm::FunctionType::get(llvm_size_type, runtime_parameters_type, false);
+  auto module = builder.GetInsertBlock()->getModule();
+  llvm::Function *runtime_function = module->getFunction(name);
+  if (!runtime_function) {
+    runtime_function = llvm::Function::Create(
+        runtime_function_type, llvm::Function::ExternalLinkage, name, module);
+  }
+  // The parameter types are copied into the module rather than referred to
+  // in place, since the code may outlive the arena of this expression.
+  std::vector<llvm::Constant *> llvm_parameters_type;
+  for (Type *parameter_type : parameters_type) {
+    llvm_parameters_type.push_back(llvm::ConstantExpr::getPtrToInt(
+        get_type_symbol(*module, parameter_type), llvm_size_type));
+  }
+  llvm::ArrayType *parameters_type_array_type =
+      llvm::ArrayType::get(llvm_size_type, parameters_type.size());
+  auto parameters_type_array = new llvm::GlobalVariable(
+      *module, parameters_type_array_type, true,
+      llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(parameters_type_array_type,
+                               llvm_parameters_type),
+      "call_site.parameters_type");
+  std::vector<llvm::Value *> runtime_arguments(leading_arguments.begin(),
+                                               leading_arguments.end());
+  runtime_arguments.push_back(llvm_function);
+  runtime_arguments.push_back(llvm::ConstantExpr::getPtrToInt(
+      get_type_symbol(*module, return_type), llvm_size_type));
+  runtime_arguments.push_back(
+      llvm::ConstantInt::get(llvm_size_type, parameters_type.size()));
+  runtime_arguments.push_back(
+      builder.CreatePtrToInt(parameters_type_array, llvm_size_type));
+  return builder.CreateCall(runtime_function_type, runtime_function,
+                            runtime_arguments);
+}
+
+llvm::Value *
+Call::build_compile_expression_call(llvm::IRBuilderBase &builder,
+                                    llvm::Value *llvm_function) const {
+  return build_runtime_call(builder, "compile_expression", {}, llvm_function);
+}
+
+llvm::Value *
+Call::build_resolve_call_site_call(llvm::IRBuilderBase &builder,
+                                   llvm::Value *cache,
+                                   llvm::Value *llvm_function) const {
+  llvm::Type *llvm_size_type =
+      get_size_type()->into_llvm_type(builder.getContext());
+  return build_runtime_call(builder, "resolve_call_site",
+                            {builder.CreatePtrToInt(cache, llvm_size_type)},
+                            llvm_function);
+}
+
+// A call site whose callee is fixed at codegen time gets a private global
+// `call_site.target` holding the entry point to jump to. It starts out at a
+// resolver stub with the callee's signature; the stub compiles the callee,
+// patches `target` and forwards its arguments, so a warm call is a single load
+// of `target` followed by an indirect call.
+llvm::Value *Call::build_call_site_lookup(llvm::IRBuilderBase &builder,
+                                          llvm::FunctionType *function_type,
+                                          llvm::Value *llvm_function) const {
+  llvm::LLVMContext &context = builder.getContext();
+  auto module = builder.GetInsertBlock()->getModule();
+  llvm::Type *llvm_size_type = get_size_type()->into_llvm_type(context);
+  llvm::PointerType *function_pointer_type =
+      llvm::PointerType::getUnqual(function_type);
+
+  if (auto constant = llvm::dyn_cast<llvm::Constant>(llvm_function)) {
+    llvm::Function *resolver = llvm::Function::Create(
+        function_type, llvm::GlobalValue::PrivateLinkage, "call_site.resolve",
+        module);
+    auto target = new llvm::GlobalVariable(
+        *module, function_pointer_type, false,
+        llvm::GlobalValue::PrivateLinkage, resolver, "call_site.target");
+    llvm::IRBuilder resolver_builder(context);
+    resolver_builder.SetInsertPoint(
+        llvm::BasicBlock::Create(context, "", resolver));
+    llvm::Value *resolved = resolver_builder.CreateIntToPtr(
+        build_compile_expression_call(resolver_builder, constant),
+        function_pointer_type);
+    // Every thread that patches `target` stores the same entry point.
+    llvm::StoreInst *patch = resolver_builder.CreateStore(resolved, target);
+    patch->setAtomic(llvm::AtomicOrdering::Release);
+    patch->setAlignment(llvm::Align(alignof(void *)));
+    std::vector<llvm::Value *> forwarded_arguments;
+    for (llvm::Argument &argument : resolver->args()) {
+      forwarded_arguments.push_back(&argument);
+    }
+    llvm::CallInst *forward = resolver_builder.CreateCall(
+        function_type, resolved, forwarded_arguments);
+    forward->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    resolver_builder.CreateRet(forward);
+
+    llvm::LoadInst *cached = builder.CreateLoad(function_pointer_type, target);
+    cached->setAtomic(llvm::AtomicOrdering::Acquire);
+    cached->setAlignment(llvm::Align(alignof(void *)));
+    return cached;
+  }
+
+  // Otherwise the callee is only known at run time. `call_site.cache` points
+  // to the CallSiteEntry of the callee last called through the site, and
+  // starts out at an empty one. A call whose callee matches the entry's key
+  // jumps to its target; any other call goes through resolve_call_site, which
+  // points the cache to the entry of the new callee. The cache is a single
+  // pointer to an entry that is not changed once published, so threads
+  // calling through the site never see a key with another callee's target.
+  llvm::Type *entry_type =
+      llvm::StructType::get(llvm_size_type, function_pointer_type);
+  auto empty_entry = new llvm::GlobalVariable(
+      *module, entry_type, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::Constant::getNullValue(entry_type), "call_site.empty");
+  auto cache = new llvm::GlobalVariable(
+      *module, empty_entry->getType(), false, llvm::GlobalValue::PrivateLinkage,
+      empty_entry, "call_site.cache");
+  llvm::LoadInst *entry = builder.CreateLoad(empty_entry->getType(), cache);
+  entry->setAtomic(llvm::AtomicOrdering::Acquire);
+  entry->setAlignment(llvm::Align(alignof(void *)));
+  // The key is cleared when the callee's code is released.
+  llvm::LoadInst *key = builder.CreateLoad(
+      llvm_size_type, builder.CreateStructGEP(entry_type, entry, 0));
+  key->setAtomic(llvm::AtomicOrdering::Monotonic);
+  key->setAlignment(llvm::Align(alignof(std::size_t)));
+  llvm::Value *cached_target = builder.CreateLoad(
+      function_pointer_type, builder.CreateStructGEP(entry_type, entry, 1));
+  llvm::BasicBlock *lookup_block = builder.GetInsertBlock();
+  llvm::Function *caller = lookup_block->getParent();
+  llvm::BasicBlock *compile_block =
+      llvm::BasicBlock::Create(context, "call_site.compile", caller);
+  llvm::BasicBlock *call_block =
+      llvm::BasicBlock::Create(context, "call_site.call", caller);
+  builder.CreateCondBr(builder.CreateICmpNE(key, llvm_function), compile_block,
+                       call_block);
+  builder.SetInsertPoint(compile_block);
+  llvm::Value *resolved = builder.CreateIntToPtr(
+      build_resolve_call_site_call(builder, cache, llvm_function),
+      function_pointer_type);
+  builder.CreateBr(call_block);
+  builder.SetInsertPoint(call_block);
+  llvm::PHINode *target = builder.CreatePHI(function_pointer_type, 2);
+  target->addIncoming(cached_target, lookup_block);
+  target->addIncoming(resolved, compile_block);
+  return target;
+}
+
+void Call::debug_print(std::ostream &os) const {
   os << "Call ";
   function->debug_print(os);
   os << "(";
@@ -437,106 +2694,2363 @@ void Call::debug_print(std::ostream &os) const {
       os << ", ";
     }
   }
-  os << ")";
+  os << ")";
+}
+
+Expression *Call::to_constructor(ExpressionArena &arena) const {
+  std::vector<Expression *> parameters_type_constructor;
+  for (Type *parameter_type : parameters_type) {
+    parameters_type_constructor.push_back(
+        arena.create<Size>(reinterpret_cast<std::size_t>(parameter_type)));
+  }
+  std::vector<Expression *> arguments_constructor;
+  for (Expression *argument : arguments) {
+    arguments_constructor.push_back(argument->to_constructor(arena));
+  }
+  return create_constructor_call(
+      arena, "create_call",
+      {
+          get_size_type(),
+          get_size_type(),
+          get_size_type(),
+          get_size_type(),
+          get_boolean_type(),
+          get_size_type(),
+      },
+      {
+          arena.create<Size>(reinterpret_cast<std::size_t>(function)),
+          arena.create<Size>(reinterpret_cast<std::size_t>(return_type)),
+          arena.create<Size>(parameters_type.size()),
+          arena.create<Array>(
+              get_size_type(),
+              arena.copy<Expression *>(parameters_type_constructor)),
+          arena.create<Boolean>(is_variadic),
+          arena.create<Array>(get_size_type(),
+                              arena.copy<Expression *>(arguments_constructor)),
+      });
+}
+
+void Call::encode(ExpressionEncoder &encoder) const {
+  encoder.write_expression(function);
+  for (Expression *argument : arguments) {
+    encoder.write_expression(argument);
+  }
+  encoder.write_kind(ExpressionKind::Call);
+  encoder.write_type(return_type);
+  encoder.write_unsigned(parameters_type.size());
+  for (Type *parameter_type : parameters_type) {
+    encoder.write_type(parameter_type);
+  }
+  encoder.write_byte(is_variadic);
+  encoder.write_unsigned(arguments.size());
+}
+
+// A callee given by address is inlined when every argument is a value,
+// which specializes its body to them; the call site and its compile call
+// disappear. A size is only taken for an expression once it is found in a
+// live arena: a ReadyMade, which only names a function, or any other number
+// is left to the call site.
+Expression *Call::simplify(Simplifier &simplifier) {
+  Expression *simplified_function = function->simplify(simplifier);
+  llvm::SmallVector<Expression *, 8> simplified_arguments;
+  bool is_changed =
+      simplify_expressions(simplifier, arguments, simplified_arguments) ||
+      simplified_function != function;
+  if (!is_variadic && simplified_function->kind() == ExpressionKind::Size &&
+      simplifier.inlining_depth < max_inlining_depth &&
+      simplifier.arena.size() - simplifier.initial_arena_size <
+          max_inlined_size &&
+      llvm::all_of(simplified_arguments, is_value)) {
+    std::size_t address = static_cast<Size *>(simplified_function)->get_value();
+    if (is_expression_address(address)) {
+      Simplifier callee_simplifier{simplifier.arena, simplified_arguments,
+                                   simplifier.inlining_depth + 1,
+                                   simplifier.initial_arena_size, false};
+      Expression *inlined =
+          reinterpret_cast<Expression *>(address)->simplify(callee_simplifier);
+      if (!callee_simplifier.has_unbound_parameter) {
+        return inlined;
+      }
+    }
+  }
+  if (!is_changed) {
+    return this;
+  }
+  return intern_call(&simplifier.arena, simplified_function, return_type,
+                     parameters_type, is_variadic, simplified_arguments);
+}
+
+// The callee itself is run by the same policy as evaluate_expression, so it
+// may be interpreted or compiled whatever the caller is.
+bool Call::can_evaluate() const {
+  return !is_variadic && is_scalar(return_type) &&
+         llvm::all_of(parameters_type, is_scalar) &&
+         function->can_evaluate() &&
+         llvm::all_of(arguments, [](const Expression *argument) {
+           return argument->can_evaluate();
+         });
+}
+
+RuntimeValue Call::evaluate(Interpreter &interpreter) const {
+  auto callee =
+      reinterpret_cast<Expression *>(function->evaluate(interpreter).size);
+  std::vector<RuntimeValue> arguments_value;
+  for (Expression *argument : arguments) {
+    arguments_value.push_back(argument->evaluate(interpreter));
+  }
+  return call_expression(callee, return_type, parameters_type,
+                         arguments_value, interpreter.allocator);
+}
+
+ExpressionKind Call::kind() const { return ExpressionKind::Call; }
+
+bool Call::equals(const Expression *other) const {
+  auto other_call = static_cast<const Call *>(other);
+  return is_equal(function, other_call->function) &&
+         return_type == other_call->return_type &&
+         parameters_type == other_call->parameters_type &&
+         is_variadic == other_call->is_variadic &&
+         is_equal(arguments, other_call->arguments);
+}
+
+extern "C" Call *create_call(ExpressionArena *arena, Expression *function,
+                             Type *return_type, std::size_t num_parameters,
+                             Type **parameters_type, bool is_variadic,
+                             Expression **arguments) {
+  return intern_call(arena, function, return_type,
+                     llvm::ArrayRef<Type *>(parameters_type, num_parameters),
+                     is_variadic,
+                     llvm::ArrayRef<Expression *>(arguments, num_parameters));
+}
+
+Bytecode::Bytecode(llvm::ArrayRef<char> data) : data(data) {
+  hash = llvm::hash_combine(ExpressionKind::Bytecode,
+                            llvm::StringRef(data.data(), data.size()));
+}
+
+llvm::Value *Bytecode::codegen(llvm::IRBuilderBase &builder) const {
+  llvm::Constant *initializer = llvm::ConstantDataArray::getString(
+      builder.getContext(), llvm::StringRef(data.data(), data.size()), false);
+  auto global = new llvm::GlobalVariable(
+      *builder.GetInsertBlock()->getModule(), initializer->getType(), true,
+      llvm::GlobalValue::PrivateLinkage, initializer, "bytecode");
+  global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+  return builder.CreatePtrToInt(
+      global, get_size_type()->into_llvm_type(builder.getContext()));
+}
+
+void Bytecode::debug_print(std::ostream &os) const {
+  os << "Bytecode " << data.size() << " bytes";
+}
+
+Expression *Bytecode::to_constructor(ExpressionArena &arena) const {
+  return create_constructor_call(arena, "create_bytecode",
+                                 {get_size_type(), get_size_type()},
+                                 {arena.create<Size>(data.size()),
+                                  arena.create<Bytecode>(data)});
+}
+
+void Bytecode::encode(ExpressionEncoder &encoder) const {
+  encoder.write_kind(ExpressionKind::Bytecode);
+  encoder.write_string(llvm::StringRef(data.data(), data.size()));
+}
+
+Expression *Bytecode::simplify(Simplifier &) { return this; }
+
+bool Bytecode::can_evaluate() const { return true; }
+
+RuntimeValue Bytecode::evaluate(Interpreter &) const {
+  return make_size(reinterpret_cast<std::size_t>(data.data()));
+}
+
+ExpressionKind Bytecode::kind() const { return ExpressionKind::Bytecode; }
+
+bool Bytecode::equals(const Expression *other) const {
+  return data == static_cast<const Bytecode *>(other)->data;
+}
+
+extern "C" Bytecode *create_bytecode(ExpressionArena *arena, std::size_t size,
+                                     const char *data) {
+  llvm::ArrayRef<char> key_data(data, size);
+  Bytecode key(key_data);
+  return static_cast<Bytecode *>(arena->intern(
+      key, [&] { return arena->create<Bytecode>(arena->copy(key_data)); }));
+}
+
+static llvm::OptimizationLevel get_optimization_level(unsigned opt_level) {
+  switch (opt_level) {
+  case 0:
+    return llvm::OptimizationLevel::O0;
+  case 1:
+    return llvm::OptimizationLevel::O1;
+  case 2:
+    return llvm::OptimizationLevel::O2;
+  default:
+    return llvm::OptimizationLevel::O3;
+  }
+}
+
+static llvm::CodeGenOptLevel get_code_gen_opt_level(unsigned opt_level) {
+  switch (opt_level) {
+  case 0:
+    return llvm::CodeGenOptLevel::None;
+  case 1:
+    return llvm::CodeGenOptLevel::Less;
+  case 2:
+    return llvm::CodeGenOptLevel::Default;
+  default:
+    return llvm::CodeGenOptLevel::Aggressive;
+  }
+}
+
+// Modules may carry a "jit.opt_level" flag to override the opt level given to
+// initialize_jit_with_options, as the tiers of tiered compilation do.
+static unsigned get_module_opt_level(const llvm::Module &module) {
+  if (auto flag = llvm::mdconst::extract_or_null<llvm::ConstantInt>(
+          module.getModuleFlag("jit.opt_level"))) {
+    return flag->getZExtValue();
+  }
+  return jit_options.opt_level;
+}
+
+// At -O0 the only pass to run is the inlining of functions marked
+// alwaysinline, such as the rows of batch functions, which only a module that
+// defines one needs.
+static void optimize_module(llvm::Module &module, unsigned opt_level) {
+  if (opt_level == 0 && llvm::none_of(module, [](llvm::Function &function) {
+        return !function.isDeclaration() &&
+               function.hasFnAttribute(llvm::Attribute::AlwaysInline);
+      })) {
+    return;
+  }
+  std::unique_ptr<llvm::TargetMachine> target_machine =
+      exit_on_error(target_machine_builder->createTargetMachine());
+  llvm::LoopAnalysisManager loop_analysis_manager;
+  llvm::FunctionAnalysisManager function_analysis_manager;
+  llvm::CGSCCAnalysisManager cgscc_analysis_manager;
+  llvm::ModuleAnalysisManager module_analysis_manager;
+  llvm::PassBuilder pass_builder(target_machine.get());
+  pass_builder.registerModuleAnalyses(module_analysis_manager);
+  pass_builder.registerCGSCCAnalyses(cgscc_analysis_manager);
+  pass_builder.registerFunctionAnalyses(function_analysis_manager);
+  pass_builder.registerLoopAnalyses(loop_analysis_manager);
+  pass_builder.crossRegisterProxies(
+      loop_analysis_manager, function_analysis_manager, cgscc_analysis_manager,
+      module_analysis_manager);
+  llvm::ModulePassManager module_pass_manager =
+      opt_level == 0 ? pass_builder.buildO0DefaultPipeline(
+                           llvm::OptimizationLevel::O0)
+                     : pass_builder.buildPerModuleDefaultPipeline(
+                           get_optimization_level(opt_level));
+  module_pass_manager.run(module, module_analysis_manager);
+}
+
+// Persistent cache of object files, one file per module in `directory`. A
+// module is looked up by the "jit.cache_key" flag that the IR transform gives
+// it, so modules without the flag are neither looked up nor stored. The
+// transform loads the object before it decides to skip optimization, and the
+// compiler then takes the loaded object, so that a file removed or replaced
+// in between cannot leave an unoptimized module to be compiled.
+class DiskObjectCache : public llvm::ObjectCache {
+  std::string directory;
+  std::mutex mutex;
+  std::unordered_multimap<std::string, std::unique_ptr<llvm::MemoryBuffer>>
+      loaded_objects;
+
+  std::string get_path(llvm::StringRef key) const;
+
+public:
+  DiskObjectCache(std::string);
+  bool load(llvm::StringRef);
+  void notifyObjectCompiled(const llvm::Module *,
+                            llvm::MemoryBufferRef) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *) override;
+};
+
+DiskObjectCache::DiskObjectCache(std::string directory)
+    : directory(std::move(directory)) {}
+
+static llvm::StringRef get_cache_key_flag(const llvm::Module *module) {
+  auto key = llvm::dyn_cast_or_null<llvm::MDString>(
+      module->getModuleFlag("jit.cache_key"));
+  return key ? key->getString() : "";
+}
+
+std::string DiskObjectCache::get_path(llvm::StringRef key) const {
+  return directory + "/" + key.str() + ".o";
+}
+
+// Reads the object of `key`, if there is one, for getObject to return to the
+// next compilation of a module with that key.
+bool DiskObjectCache::load(llvm::StringRef key) {
+  auto buffer = llvm::MemoryBuffer::getFile(get_path(key));
+  if (!buffer) {
+    return false;
+  }
+  std::lock_guard lock(mutex);
+  loaded_objects.emplace(key.str(), std::move(*buffer));
+  return true;
+}
+
+// Objects are written to a unique temporary file that is then renamed over
+// the final path, so concurrent writers and readers never see partial files.
+void DiskObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                           llvm::MemoryBufferRef object) {
+  llvm::StringRef key = get_cache_key_flag(module);
+  if (key.empty()) {
+    return;
+  }
+  std::string path = get_path(key);
+  int file_descriptor;
+  llvm::SmallString<128> temporary_path;
+  if (llvm::sys::fs::createUniqueFile(directory + "/%%%%%%%%%%%%.tmp",
+                                      file_descriptor, temporary_path)) {
+    return;
+  }
+  {
+    llvm::raw_fd_ostream stream(file_descriptor, true);
+    stream << object.getBuffer();
+    stream.close();
+    if (stream.has_error()) {
+      stream.clear_error();
+      llvm::sys::fs::remove(temporary_path);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(temporary_path, path)) {
+    llvm::sys::fs::remove(temporary_path);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+DiskObjectCache::getObject(const llvm::Module *module) {
+  llvm::StringRef key = get_cache_key_flag(module);
+  if (key.empty()) {
+    return nullptr;
+  }
+  std::lock_guard lock(mutex);
+  auto loaded = loaded_objects.find(key.str());
+  if (loaded == loaded_objects.end()) {
+    return nullptr;
+  }
+  auto buffer = std::move(loaded->second);
+  loaded_objects.erase(loaded);
+  return buffer;
+}
+
+// The key covers everything the object code depends on: the unoptimized
+// module, the target and the opt level. Modules refer to host objects through
+// absolute symbols rather than by address, so the same module gets the same
+// key in every run; those that cannot are excluded from the cache.
+static std::string get_cache_key(const llvm::Module &module,
+                                 unsigned opt_level) {
+  llvm::SmallVector<char, 0> bitcode;
+  llvm::raw_svector_ostream bitcode_stream(bitcode);
+  llvm::WriteBitcodeToFile(module, bitcode_stream);
+  llvm::SHA1 hasher;
+  hasher.update(llvm::StringRef(bitcode.data(), bitcode.size()));
+  hasher.update(target_machine_builder->getTargetTriple().str());
+  hasher.update(target_machine_builder->getCPU());
+  hasher.update(target_machine_builder->getFeatures().getString());
+  hasher.update(std::to_string(opt_level));
+  return llvm::toHex(hasher.result(), true);
+}
+
+// Adds the time from its construction to its destruction to the total of the
+// phase, and records it while tracing. Timers of different phases may nest,
+// as lookups do around the phases they wait for.
+class PhaseTimer {
+  CompilePhase phase;
+  std::string detail;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  PhaseTimer(CompilePhase, std::string detail = "");
+  ~PhaseTimer();
+};
+
+PhaseTimer::PhaseTimer(CompilePhase phase, std::string detail)
+    : phase(phase), detail(std::move(detail)),
+      start(std::chrono::steady_clock::now()) {}
+
+PhaseTimer::~PhaseTimer() {
+  auto duration = std::chrono::steady_clock::now() - start;
+  compile_phase_times[static_cast<std::size_t>(phase)] +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  if (is_tracing) {
+    std::lock_guard lock(trace_mutex);
+    trace_events.push_back(TraceEvent{phase, std::move(detail), start,
+                                      duration, llvm::get_threadid()});
+  }
+}
+
+// Names a module in traces after its first function.
+static std::string describe_module(const llvm::Module &module) {
+  for (const llvm::Function &function : module) {
+    if (!function.isDeclaration()) {
+      return function.getName().str();
+    }
+  }
+  return "";
+}
+
+// Like ORC's ConcurrentIRCompiler, but picks the code generator's opt level
+// per module.
+class OptLevelCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+  llvm::orc::JITTargetMachineBuilder target_machine_builder;
+
+public:
+  OptLevelCompiler(llvm::orc::JITTargetMachineBuilder);
+  llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+  operator()(llvm::Module &) override;
+};
+
+OptLevelCompiler::OptLevelCompiler(
+    llvm::orc::JITTargetMachineBuilder target_machine_builder)
+    : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(
+          target_machine_builder.getOptions())),
+      target_machine_builder(std::move(target_machine_builder)) {}
+
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+OptLevelCompiler::operator()(llvm::Module &module) {
+  PhaseTimer timer(CompilePhase::CodeGeneration, describe_module(module));
+  llvm::orc::JITTargetMachineBuilder module_target_machine_builder =
+      target_machine_builder;
+  module_target_machine_builder.setCodeGenOptLevel(
+      get_code_gen_opt_level(get_module_opt_level(module)));
+  auto target_machine = module_target_machine_builder.createTargetMachine();
+  if (!target_machine) {
+    return target_machine.takeError();
+  }
+  return llvm::orc::SimpleCompiler(**target_machine, object_cache.get())(
+      module);
+}
+
+// Counts the sections it allocates in the JIT's memory statistics. The object
+// linking layer makes one per object and deletes it with the object when the
+// object's resource tracker is removed.
+class CountingMemoryManager : public llvm::SectionMemoryManager {
+  std::size_t code_bytes = 0;
+  std::size_t data_bytes = 0;
+
+public:
+  CountingMemoryManager();
+  ~CountingMemoryManager() override;
+  std::uint8_t *allocateCodeSection(std::uintptr_t, unsigned, unsigned,
+                                    llvm::StringRef) override;
+  std::uint8_t *allocateDataSection(std::uintptr_t, unsigned, unsigned,
+                                    llvm::StringRef, bool) override;
+};
+
+CountingMemoryManager::CountingMemoryManager() { num_loaded_objects++; }
+
+CountingMemoryManager::~CountingMemoryManager() {
+  num_code_bytes -= code_bytes;
+  num_data_bytes -= data_bytes;
+  num_loaded_objects--;
+}
+
+std::uint8_t *CountingMemoryManager::allocateCodeSection(
+    std::uintptr_t size, unsigned alignment, unsigned section_id,
+    llvm::StringRef section_name) {
+  code_bytes += size;
+  num_code_bytes += size;
+  num_emitted_code_bytes += size;
+  return SectionMemoryManager::allocateCodeSection(size, alignment,
+                                                   section_id, section_name);
+}
+
+std::uint8_t *CountingMemoryManager::allocateDataSection(
+    std::uintptr_t size, unsigned alignment, unsigned section_id,
+    llvm::StringRef section_name, bool is_read_only) {
+  data_bytes += size;
+  num_data_bytes += size;
+  return SectionMemoryManager::allocateDataSection(
+      size, alignment, section_id, section_name, is_read_only);
+}
+
+// Appends the functions of every loaded object to /tmp/perf-<pid>.map, where
+// perf looks up the names of addresses outside any mapped file. Unlike a
+// jitdump file it needs no perf support in LLVM nor `perf inject`, but perf
+// cannot annotate the code of the functions it names.
+class PerfMapListener : public llvm::JITEventListener {
+  std::mutex mutex;
+  std::unique_ptr<llvm::raw_fd_ostream> stream;
+
+public:
+  void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile &,
+                          const llvm::RuntimeDyld::LoadedObjectInfo &) override;
+};
+
+void PerfMapListener::notifyObjectLoaded(
+    ObjectKey, const llvm::object::ObjectFile &object,
+    const llvm::RuntimeDyld::LoadedObjectInfo &info) {
+  // The object for debuggers has its sections at their load addresses.
+  auto debug_object = info.getObjectForDebug(object);
+  if (!debug_object.getBinary()) {
+    return;
+  }
+  std::lock_guard lock(mutex);
+  if (!stream) {
+    std::string path = "/tmp/perf-" +
+                       std::to_string(llvm::sys::Process::getProcessId()) +
+                       ".map";
+    std::error_code error;
+    stream = std::make_unique<llvm::raw_fd_ostream>(path, error,
+                                                    llvm::sys::fs::OF_Append);
+    exit_on_error(llvm::errorCodeToError(error));
+  }
+  for (auto &[symbol, size] :
+       llvm::object::computeSymbolSizes(*debug_object.getBinary())) {
+    auto type = symbol.getType();
+    auto name = symbol.getName();
+    auto address = symbol.getAddress();
+    if (!type || !name || !address ||
+        *type != llvm::object::SymbolRef::ST_Function || size == 0) {
+      llvm::consumeError(type.takeError());
+      llvm::consumeError(name.takeError());
+      llvm::consumeError(address.takeError());
+      continue;
+    }
+    *stream << llvm::format_hex_no_prefix(*address, 1) << ' '
+            << llvm::format_hex_no_prefix(size, 1) << ' ' << *name << '\n';
+  }
+  stream->flush();
+}
+
+// Remembers the name of every externally visible function of the loaded
+// objects by address, so that profile-guided recompilation can tell which
+// function the calls at a call site went to.
+class FunctionAddressListener : public llvm::JITEventListener {
+  std::mutex mutex;
+  std::map<std::uint64_t, std::string> names;
+  std::map<ObjectKey, std::vector<std::uint64_t>> object_addresses;
+
+public:
+  void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile &,
+                          const llvm::RuntimeDyld::LoadedObjectInfo &) override;
+  void notifyFreeingObject(ObjectKey) override;
+  // Empty if no function starts at `address`.
+  std::string get_name(std::uint64_t address);
+};
+
+void FunctionAddressListener::notifyObjectLoaded(
+    ObjectKey key, const llvm::object::ObjectFile &object,
+    const llvm::RuntimeDyld::LoadedObjectInfo &info) {
+  auto debug_object = info.getObjectForDebug(object);
+  if (!debug_object.getBinary()) {
+    return;
+  }
+  std::lock_guard lock(mutex);
+  for (const llvm::object::SymbolRef &symbol :
+       debug_object.getBinary()->symbols()) {
+    auto type = symbol.getType();
+    auto flags = symbol.getFlags();
+    auto name = symbol.getName();
+    auto address = symbol.getAddress();
+    if (!type || !flags || !name || !address ||
+        *type != llvm::object::SymbolRef::ST_Function ||
+        !(*flags & llvm::object::SymbolRef::SF_Global)) {
+      llvm::consumeError(type.takeError());
+      llvm::consumeError(flags.takeError());
+      llvm::consumeError(name.takeError());
+      llvm::consumeError(address.takeError());
+      continue;
+    }
+    names[*address] = name->str();
+    object_addresses[key].push_back(*address);
+  }
+}
+
+void FunctionAddressListener::notifyFreeingObject(ObjectKey key) {
+  std::lock_guard lock(mutex);
+  auto found = object_addresses.find(key);
+  if (found == object_addresses.end()) {
+    return;
+  }
+  for (std::uint64_t address : found->second) {
+    names.erase(address);
+  }
+  object_addresses.erase(found);
+}
+
+std::string FunctionAddressListener::get_name(std::uint64_t address) {
+  std::lock_guard lock(mutex);
+  auto found = names.find(address);
+  return found == names.end() ? "" : found->second;
+}
+
+static FunctionAddressListener function_address_listener;
+
+// Times the linking of each object. Objects are linked on the thread that
+// generated them, once the symbols they refer to are defined.
+class TimedObjectLinkingLayer : public llvm::orc::RTDyldObjectLinkingLayer {
+public:
+  using RTDyldObjectLinkingLayer::RTDyldObjectLinkingLayer;
+  void emit(std::unique_ptr<llvm::orc::MaterializationResponsibility>,
+            std::unique_ptr<llvm::MemoryBuffer>) override;
+};
+
+void TimedObjectLinkingLayer::emit(
+    std::unique_ptr<llvm::orc::MaterializationResponsibility> responsibility,
+    std::unique_ptr<llvm::MemoryBuffer> object) {
+  PhaseTimer timer(CompilePhase::Linking);
+  RTDyldObjectLinkingLayer::emit(std::move(responsibility), std::move(object));
+}
+
+// Configures either kind of LLJIT builder and creates the JIT.
+template <typename Builder>
+static std::unique_ptr<llvm::orc::LLJIT>
+create_jit(Builder &jit_builder, unsigned num_compile_threads) {
+  jit_builder.setJITTargetMachineBuilder(*target_machine_builder);
+  jit_builder.setCompileFunctionCreator(
+      [](llvm::orc::JITTargetMachineBuilder target_machine_builder)
+          -> llvm::Expected<
+              std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+        return std::make_unique<OptLevelCompiler>(
+            std::move(target_machine_builder));
+      });
+  // Objects are linked by RuntimeDyld, whose memory managers let the memory
+  // statistics follow objects being loaded and freed.
+  jit_builder.setObjectLinkingLayerCreator(
+      [](llvm::orc::ExecutionSession &session, const llvm::Triple &)
+          -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>> {
+        auto layer = std::make_unique<TimedObjectLinkingLayer>(
+            session, [] { return std::make_unique<CountingMemoryManager>(); });
+        if (jit_options.profile_guided_recompilation) {
+          layer->registerJITEventListener(function_address_listener);
+        }
+        if (jit_options.profiler_support) {
+          static PerfMapListener perf_map_listener;
+          layer->registerJITEventListener(perf_map_listener);
+          layer->registerJITEventListener(
+              *llvm::JITEventListener::createGDBRegistrationListener());
+          // Null unless LLVM is built with LLVM_USE_PERF.
+          if (auto *listener =
+                  llvm::JITEventListener::createPerfJITEventListener()) {
+            layer->registerJITEventListener(*listener);
+          }
+        }
+        return layer;
+      });
+  if (num_compile_threads > 0) {
+    jit_builder.setNumCompileThreads(num_compile_threads);
+  }
+  return exit_on_error(jit_builder.create());
+}
+
+static llvm::Error define_absolute_symbols(
+    llvm::ArrayRef<std::pair<const char *, void *>> symbols) {
+  llvm::orc::SymbolMap symbol_map;
+  for (auto &[name, address] : symbols) {
+    symbol_map[jit->mangleAndIntern(name)] = llvm::orc::ExecutorSymbolDef(
+        llvm::orc::ExecutorAddr::fromPtr(address),
+        llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+  }
+  return jit->getMainJITDylib().define(
+      llvm::orc::absoluteSymbols(std::move(symbol_map)));
+}
+
+// Defines the functions generated code calls by name: the runtime entry
+// points, the create_* functions constructor code calls, and the C library
+// functions the code generator emits calls to. They resolve without searching
+// the process, and without the executable exporting its own symbols.
+static void define_runtime_symbols() {
+  exit_on_error(define_absolute_symbols({
+      {"compile_expression", reinterpret_cast<void *>(&compile_expression)},
+      {"resolve_call_site", reinterpret_cast<void *>(&resolve_call_site)},
+      {"tier_up", reinterpret_cast<void *>(&tier_up)},
+      {"decode_expression", reinterpret_cast<void *>(&decode_expression)},
+      {"create_parameter", reinterpret_cast<void *>(&create_parameter)},
+      {"create_boolean", reinterpret_cast<void *>(&create_boolean)},
+      {"create_integer", reinterpret_cast<void *>(&create_integer)},
+      {"create_add_integer", reinterpret_cast<void *>(&create_add_integer)},
+      {"create_float", reinterpret_cast<void *>(&create_float)},
+      {"create_double", reinterpret_cast<void *>(&create_double)},
+      {"create_add_float", reinterpret_cast<void *>(&create_add_float)},
+      {"create_subtract_float",
+       reinterpret_cast<void *>(&create_subtract_float)},
+      {"create_multiply_float",
+       reinterpret_cast<void *>(&create_multiply_float)},
+      {"create_divide_float", reinterpret_cast<void *>(&create_divide_float)},
+      {"create_vector", reinterpret_cast<void *>(&create_vector)},
+      {"create_extract_element",
+       reinterpret_cast<void *>(&create_extract_element)},
+      {"create_size", reinterpret_cast<void *>(&create_size)},
+      {"create_string", reinterpret_cast<void *>(&create_string)},
+      {"create_print", reinterpret_cast<void *>(&create_print)},
+      {"create_array", reinterpret_cast<void *>(&create_array)},
+      {"create_function", reinterpret_cast<void *>(&create_function)},
+      {"create_call", reinterpret_cast<void *>(&create_call)},
+      {"create_bytecode", reinterpret_cast<void *>(&create_bytecode)},
+      {"fwrite", reinterpret_cast<void *>(&std::fwrite)},
+      {"stdout", reinterpret_cast<void *>(&stdout)},
+      {"memcpy", reinterpret_cast<void *>(&std::memcpy)},
+      {"memmove", reinterpret_cast<void *>(&std::memmove)},
+      {"memset", reinterpret_cast<void *>(&std::memset)},
+  }));
+}
+
+extern "C" bool register_symbol(const char *name, void *address) {
+  if (!jit) {
+    return false;
+  }
+  if (llvm::Error error = define_absolute_symbols({{name, address}})) {
+    llvm::consumeError(std::move(error));
+    return false;
+  }
+  return true;
+}
+
+// The bitcode of the runtime helpers in runtime.ll, assembled by build.rs.
+static const unsigned char runtime_bitcode[] = {
+#include "runtime_bitcode.inc"
+};
+
+// Names of the functions runtime.ll defines.
+static std::unordered_set<std::string> runtime_helper_names;
+
+static std::unique_ptr<llvm::Module>
+parse_runtime_helpers(llvm::LLVMContext &context) {
+  llvm::MemoryBufferRef buffer(
+      llvm::StringRef(reinterpret_cast<const char *>(runtime_bitcode),
+                      sizeof(runtime_bitcode)),
+      "runtime.bc");
+  return exit_on_error(llvm::parseBitcodeFile(buffer, context));
+}
+
+// Adds the runtime helpers to the JIT, which defines them for the calls the
+// optimizer does not inline and for the interpreter.
+static void define_runtime_helpers() {
+  auto context = std::make_unique<llvm::LLVMContext>();
+  auto module = parse_runtime_helpers(*context);
+  for (llvm::Function &function : *module) {
+    if (!function.isDeclaration()) {
+      runtime_helper_names.insert(function.getName().str());
+    }
+  }
+  exit_on_error(jit->addIRModule(
+      llvm::orc::ThreadSafeModule(std::move(module), std::move(context))));
+}
+
+// Links the runtime helpers `module` calls into it with available_externally
+// linkage: the optimizer can inline them, and code generation drops the
+// bodies it is left with, so the calls it keeps go to the JIT's definitions.
+static void link_runtime_helpers(llvm::Module &module) {
+  bool calls_helper = llvm::any_of(module, [](llvm::Function &function) {
+    return function.isDeclaration() &&
+           runtime_helper_names.count(function.getName().str());
+  });
+  if (!calls_helper) {
+    return;
+  }
+  // Every staged expression's module is on the compile queue's context, which
+  // keeps the helpers parsed. The other contexts hold a module or a few, and
+  // parse their own.
+  std::unique_ptr<llvm::Module> runtime;
+  if (&module.getContext() == compile_queue.context.getContext()) {
+    if (!compile_queue.runtime_helpers) {
+      compile_queue.runtime_helpers =
+          parse_runtime_helpers(module.getContext());
+    }
+    runtime = llvm::CloneModule(*compile_queue.runtime_helpers);
+  } else {
+    runtime = parse_runtime_helpers(module.getContext());
+  }
+  runtime->setDataLayout(module.getDataLayout());
+  runtime->setTargetTriple(module.getTargetTriple());
+  // Only the helpers declared with their own signature are linked. The
+  // helpers do not call each other, so the rest can go.
+  for (llvm::Function &function : llvm::make_early_inc_range(*runtime)) {
+    if (function.isDeclaration()) {
+      continue;
+    }
+    llvm::Function *declaration = module.getFunction(function.getName());
+    if (!declaration || !declaration->isDeclaration() ||
+        declaration->getFunctionType() != function.getFunctionType()) {
+      function.eraseFromParent();
+    }
+  }
+  if (llvm::Linker::linkModules(module, std::move(runtime))) {
+    exit_on_error(llvm::make_error<llvm::StringError>(
+        "cannot link the runtime helpers", llvm::inconvertibleErrorCode()));
+  }
+  for (llvm::Function &function : module) {
+    if (!function.isDeclaration() &&
+        runtime_helper_names.count(function.getName().str())) {
+      function.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+    }
+  }
+}
+
+JitOptions::JitOptions()
+    : opt_level(0), tune_for_host(false), tier_up_threshold(0),
+      cache_directory(nullptr), num_compile_threads(0),
+      lazy_compilation(false), interpreter_threshold(0),
+      search_process_symbols(true), profiler_support(false),
+      profile_execution(false), profile_cycles(false),
+      profile_guided_recompilation(false) {}
+
+extern "C" void get_default_jit_options(JitOptions *options) {
+  *options = JitOptions();
+}
+
+extern "C" void initialize_jit() {
+  JitOptions options;
+  initialize_jit_with_options(&options);
+}
+
+extern "C" void initialize_jit_with_options(const JitOptions *options) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  jit_options = *options;
+  if (options->cache_directory) {
+    exit_on_error(llvm::errorCodeToError(
+        llvm::sys::fs::create_directories(options->cache_directory)));
+    object_cache = std::make_unique<DiskObjectCache>(options->cache_directory);
+  }
+  target_machine_builder =
+      std::make_unique<llvm::orc::JITTargetMachineBuilder>(
+          options->tune_for_host
+              ? exit_on_error(llvm::orc::JITTargetMachineBuilder::detectHost())
+              : llvm::orc::JITTargetMachineBuilder(
+                    llvm::Triple(llvm::sys::getProcessTriple())));
+  // Asynchronous compiles and optimized tiers are materialized on a compile
+  // thread, off the caller's path; without one, ORC would materialize them on
+  // the calling thread before returning.
+  unsigned num_compile_threads =
+      std::max(options->num_compile_threads, 1u);
+  if (options->lazy_compilation) {
+    llvm::orc::LLLazyJITBuilder jit_builder;
+    jit = create_jit(jit_builder, num_compile_threads);
+  } else {
+    llvm::orc::LLJITBuilder jit_builder;
+    jit = create_jit(jit_builder, num_compile_threads);
+  }
+  define_runtime_symbols();
+  define_runtime_helpers();
+  if (options->search_process_symbols) {
+    char global_prefix = jit->getDataLayout().getGlobalPrefix();
+    auto generator = exit_on_error(
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            global_prefix));
+    jit->getMainJITDylib().addGenerator(std::move(generator));
+  }
+  jit->getIRTransformLayer().setTransform(
+      [](llvm::orc::ThreadSafeModule module,
+         llvm::orc::MaterializationResponsibility &)
+          -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+        module.withModuleDo([](llvm::Module &module) {
+          for (llvm::Function &function : module) {
+            if (!function.isDeclaration()) {
+              num_materialized_functions++;
+            }
+          }
+          link_runtime_helpers(module);
+          unsigned opt_level = get_module_opt_level(module);
+          if (object_cache && !module.getModuleFlag("jit.uncacheable")) {
+            std::string key = get_cache_key(module, opt_level);
+            module.addModuleFlag(llvm::Module::Override, "jit.cache_key",
+                                 llvm::MDString::get(module.getContext(), key));
+            if (object_cache->load(key)) {
+              // The compiler will take the loaded object instead of
+              // generating code, so there is nothing to optimize for.
+              return;
+            }
+          }
+          {
+            PhaseTimer timer(CompilePhase::Optimization,
+                             describe_module(module));
+            optimize_module(module, opt_level);
+          }
+          num_optimized_modules++;
+          num_optimized_instructions += module.getInstructionCount();
+        });
+        return std::move(module);
+      });
+}
+
+extern "C" std::size_t get_materialized_function_count() {
+  return num_materialized_functions;
+}
+
+TierState::TierState(std::string name,
+                     std::shared_ptr<llvm::orc::ThreadSafeModule> source,
+                     llvm::orc::ResourceTrackerSP resource_tracker)
+    : call_count(0), tier(1), name(std::move(name)), source(std::move(source)),
+      resource_tracker(std::move(resource_tracker)),
+      is_tier_up_finished(false) {}
+
+void TierState::finish_tier_up() {
+  std::lock_guard lock(mutex);
+  is_tier_up_finished = true;
+  tier_up_finished.notify_all();
+}
+
+// A function becomes hot only once, when its count reaches the threshold, and
+// the call that reached it is already on its way to tier_up.
+void TierState::wait_for_tier_up() {
+  if (call_count < jit_options.tier_up_threshold) {
+    return;
+  }
+  std::unique_lock lock(mutex);
+  tier_up_finished.wait(lock, [this] { return is_tier_up_finished; });
+}
+
+static void build_counter_add(llvm::IRBuilderBase &builder,
+                              const std::string &name,
+                              std::atomic<std::uint64_t> *counter,
+                              llvm::Value *amount) {
+  auto module = builder.GetInsertBlock()->getModule();
+  builder.CreateAtomicRMW(
+      llvm::AtomicRMWInst::Add,
+      get_host_symbol(*module, name, counter, amount->getType()), amount,
+      llvm::MaybeAlign(alignof(std::uint64_t)),
+      llvm::AtomicOrdering::Monotonic);
+}
+
+// The block of a call site with a run-time callee that resolves the callee when
+// the call site's cache misses, or null if the call has none.
+static llvm::BasicBlock *get_compile_block(llvm::CallInst &call) {
+  auto target = llvm::dyn_cast<llvm::PHINode>(call.getCalledOperand());
+  if (!target) {
+    return nullptr;
+  }
+  for (llvm::BasicBlock *block : target->blocks()) {
+    if (block->getName().starts_with("call_site.compile")) {
+      return block;
+    }
+  }
+  return nullptr;
+}
+
+// Makes every externally visible function defined in `module` count its
+// entries, the calls at its Call sites, where calls through a run-time callee
+// went and how many of them missed the call site's cache, and its cycles if
+// profile_cycles is set, in its FunctionProfile. Runs before tiering, so that
+// the optimized tier counts too unless it is compiled with the profile.
+static void instrument_module(llvm::Module &module) {
+  llvm::LLVMContext &context = module.getContext();
+  llvm::Type *counter_type = llvm::Type::getInt64Ty(context);
+  llvm::Value *one = llvm::ConstantInt::get(counter_type, 1);
+  std::lock_guard lock(profiles_mutex);
+  for (llvm::Function &function : module) {
+    if (function.isDeclaration() || !function.hasExternalLinkage()) {
+      continue;
+    }
+    std::string name = function.getName().str();
+    auto &profile = function_profiles[name];
+    if (!profile) {
+      profile = std::make_unique<FunctionProfile>();
+      profile->name = name;
+    }
+    std::vector<llvm::CallInst *> calls;
+    std::vector<llvm::ReturnInst *> returns;
+    for (llvm::Instruction &instruction : llvm::instructions(function)) {
+      if (auto call = llvm::dyn_cast<llvm::CallInst>(&instruction)) {
+        if (call->getMetadata("jit.call_site")) {
+          calls.push_back(call);
+        }
+      } else if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(&instruction)) {
+        returns.push_back(ret);
+      }
+    }
+
+    // Tags the instrumentation so that strip_instrumentation can find it.
+    unsigned kind = context.getMDKindID("jit.profile");
+    llvm::MDNode *tag = llvm::MDNode::get(context, {});
+    llvm::IRBuilder<llvm::ConstantFolder, llvm::IRBuilderCallbackInserter>
+        builder(context, llvm::ConstantFolder(),
+                llvm::IRBuilderCallbackInserter(
+                    [&](llvm::Instruction *instruction) {
+                      instruction->setMetadata(kind, tag);
+                    }));
+    builder.SetInsertPoint(&*function.getEntryBlock().getFirstInsertionPt());
+    std::string prefix = "profile." + name + ".";
+    build_counter_add(builder, prefix + "entry_count", &profile->entry_count,
+                      one);
+    llvm::Value *start_cycles = nullptr;
+    if (jit_options.profile_cycles) {
+      start_cycles =
+          builder.CreateIntrinsic(llvm::Intrinsic::readcyclecounter, {}, {});
+      for (llvm::ReturnInst *ret : returns) {
+        builder.SetInsertPoint(ret);
+        llvm::Value *end_cycles =
+            builder.CreateIntrinsic(llvm::Intrinsic::readcyclecounter, {}, {});
+        build_counter_add(builder, prefix + "cycles", &profile->cycles,
+                          builder.CreateSub(end_cycles, start_cycles));
+      }
+    }
+    for (std::size_t index = 0; index < calls.size(); index++) {
+      if (index == profile->call_sites.size()) {
+        profile->call_sites.push_back(std::make_unique<CallSiteProfile>());
+      }
+      CallSiteProfile &call_site = *profile->call_sites[index];
+      llvm::CallInst *call = calls[index];
+      llvm::Function *callee = call->getCalledFunction();
+      call_site.callee = callee ? callee->getName().str() : "";
+      // The call site's index in the profile, for apply_profile.
+      call->setMetadata(
+          "jit.call_site",
+          llvm::MDNode::get(context,
+                            llvm::ConstantAsMetadata::get(
+                                llvm::ConstantInt::get(counter_type, index))));
+      std::string call_site_prefix = prefix + std::to_string(index) + ".";
+      builder.SetInsertPoint(call);
+      build_counter_add(builder, call_site_prefix + "count", &call_site.count,
+                        one);
+      if (!callee) {
+        llvm::Type *address_type = get_size_type()->into_llvm_type(context);
+        llvm::Value *target =
+            get_host_symbol(module, call_site_prefix + "target",
+                            &call_site.target, address_type);
+        llvm::LoadInst *previous = builder.CreateLoad(address_type, target);
+        previous->setAtomic(llvm::AtomicOrdering::Monotonic);
+        previous->setAlignment(llvm::Align(alignof(std::uintptr_t)));
+        llvm::Value *address =
+            builder.CreatePtrToInt(call->getCalledOperand(), address_type);
+        llvm::StoreInst *store = builder.CreateStore(address, target);
+        store->setAtomic(llvm::AtomicOrdering::Monotonic);
+        store->setAlignment(llvm::Align(alignof(std::uintptr_t)));
+        build_counter_add(
+            builder, call_site_prefix + "target_count", &call_site.target_count,
+            builder.CreateZExt(builder.CreateICmpEQ(previous, address),
+                               counter_type));
+        if (llvm::BasicBlock *compile_block = get_compile_block(*call)) {
+          builder.SetInsertPoint(&*compile_block->getFirstInsertionPt());
+          build_counter_add(builder, call_site_prefix + "compile_count",
+                            &call_site.compile_count, one);
+        }
+      }
+    }
+  }
+}
+
+// Turns every externally visible function `f` defined in `module` into a
+// tiered function: the body moves to a private `f.tier1`, which counts its
+// calls and asks tier_up for optimized code once the count reaches the
+// threshold, and `f` becomes a stub that jumps through `f.implementation`.
+static void
+split_tiers(llvm::Module &module,
+            const std::shared_ptr<llvm::orc::ThreadSafeModule> &source,
+            const llvm::orc::ResourceTrackerSP &resource_tracker) {
+  llvm::LLVMContext &context = module.getContext();
+  llvm::Type *llvm_size_type = get_size_type()->into_llvm_type(context);
+  llvm::Type *void_type = llvm::Type::getVoidTy(context);
+  llvm::Type *slot_type = llvm::PointerType::getUnqual(llvm_size_type);
+  llvm::FunctionType *tier_up_type =
+      llvm::FunctionType::get(void_type, {llvm_size_type, slot_type}, false);
+  std::vector<llvm::Function *> functions;
+  for (llvm::Function &function : module) {
+    if (!function.isDeclaration() && function.hasExternalLinkage()) {
+      functions.push_back(&function);
+    }
+  }
+  for (llvm::Function *function : functions) {
+    std::string name = function->getName().str();
+    auto state = std::make_shared<TierState>(name, source, resource_tracker);
+
+    function->setName(name + ".tier1");
+    function->setLinkage(llvm::GlobalValue::PrivateLinkage);
+    llvm::FunctionType *function_type = function->getFunctionType();
+    llvm::PointerType *function_pointer_type =
+        llvm::PointerType::getUnqual(function_type);
+    llvm::Function *stub = llvm::Function::Create(
+        function_type, llvm::GlobalValue::ExternalLinkage, name, module);
+    function->replaceAllUsesWith(stub);
+    auto implementation = new llvm::GlobalVariable(
+        module, function_pointer_type, false,
+        llvm::GlobalValue::PrivateLinkage, function, name + ".implementation");
+
+    llvm::IRBuilder stub_builder(context);
+    stub_builder.SetInsertPoint(llvm::BasicBlock::Create(context, "", stub));
+    llvm::LoadInst *target =
+        stub_builder.CreateLoad(function_pointer_type, implementation);
+    target->setAtomic(llvm::AtomicOrdering::Acquire);
+    target->setAlignment(llvm::Align(alignof(void *)));
+    std::vector<llvm::Value *> forwarded_arguments;
+    for (llvm::Argument &argument : stub->args()) {
+      forwarded_arguments.push_back(&argument);
+    }
+    llvm::CallInst *forward =
+        stub_builder.CreateCall(function_type, target, forwarded_arguments);
+    forward->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    stub_builder.CreateRet(forward);
+
+    llvm::BasicBlock *body = &function->getEntryBlock();
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(context, "", function, body);
+    llvm::BasicBlock *hot =
+        llvm::BasicBlock::Create(context, "", function, body);
+    // The state goes away with the code, so its symbols are defined under
+    // the same tracker rather than through get_host_symbol.
+    define_host_symbol("tier." + name, state.get(), resource_tracker);
+    define_host_symbol("tier." + name + ".call_count", &state->call_count,
+                       resource_tracker);
+    llvm::IRBuilder counter_builder(entry);
+    llvm::Value *previous_count = counter_builder.CreateAtomicRMW(
+        llvm::AtomicRMWInst::Add,
+        module.getOrInsertGlobal("tier." + name + ".call_count",
+                                 llvm_size_type),
+        llvm::ConstantInt::get(llvm_size_type, 1),
+        llvm::MaybeAlign(alignof(std::size_t)),
+        llvm::AtomicOrdering::Monotonic);
+    counter_builder.CreateCondBr(
+        counter_builder.CreateICmpEQ(
+            previous_count, llvm::ConstantInt::get(
+                                llvm_size_type,
+                                jit_options.tier_up_threshold - 1)),
+        hot, body);
+    counter_builder.SetInsertPoint(hot);
+    counter_builder.CreateCall(
+        module.getOrInsertFunction("tier_up", tier_up_type),
+        {llvm::ConstantExpr::getPtrToInt(
+             module.getOrInsertGlobal("tier." + name,
+                                      llvm::Type::getInt8Ty(context)),
+             llvm_size_type),
+         counter_builder.CreatePointerCast(implementation, slot_type)});
+    counter_builder.CreateBr(body);
+
+    if (jit_options.profile_guided_recompilation) {
+      std::lock_guard lock(profiles_mutex);
+      auto profile = function_profiles.find(name);
+      if (profile != function_profiles.end()) {
+        profile->second->source = source;
+      }
+    }
+    tier_states[name] = std::move(state);
+  }
+  module.addModuleFlag(llvm::Module::Override, "jit.opt_level", 0u);
+}
+
+// The arenas that each resource tracker's code refers to, which it holds until
+// the code is removed. Guarded by compile_mutex.
+struct ArenaReferences {
+  llvm::orc::ResourceTrackerSP resource_tracker;
+  llvm::SmallVector<ExpressionArena *, 1> arenas;
+};
+
+static std::unordered_map<llvm::orc::ResourceTracker *, ArenaReferences>
+    arena_references;
+
+// Makes `resource_tracker` a holder of the arenas that add_arena_reference
+// noted in the module, once each. Callers hold compile_mutex.
+static void
+take_arena_references(llvm::Module &module,
+                      const llvm::orc::ResourceTrackerSP &resource_tracker) {
+  llvm::NamedMDNode *references = module.getNamedMetadata("jit.arenas");
+  if (!references) {
+    return;
+  }
+  ArenaReferences &held = arena_references[resource_tracker.get()];
+  held.resource_tracker = resource_tracker;
+  for (llvm::MDNode *reference : references->operands()) {
+    auto arena = reinterpret_cast<ExpressionArena *>(
+        llvm::mdconst::extract<llvm::ConstantInt>(reference->getOperand(0))
+            ->getZExtValue());
+    if (!llvm::is_contained(held.arenas, arena) && retain_arena(arena)) {
+      held.arenas.push_back(arena);
+    }
+  }
+  module.eraseNamedMetadata(references);
+}
+
+// Hands a module to the JIT under `resource_tracker`, splitting it into tiers
+// first when tiered compilation is enabled. A lazy module is compiled a
+// function at a time as its functions are first called. Callers hold
+// compile_mutex.
+static void add_module(llvm::orc::ThreadSafeModule module,
+                       const llvm::orc::ResourceTrackerSP &resource_tracker,
+                       bool is_lazy = false) {
+  module.withModuleDo([&](llvm::Module &module) {
+    take_arena_references(module, resource_tracker);
+  });
+  if (jit_options.profile_execution) {
+    module.withModuleDo(instrument_module);
+  }
+  if (jit_options.tier_up_threshold > 0) {
+    auto source = std::make_shared<llvm::orc::ThreadSafeModule>(
+        module.withModuleDo([](llvm::Module &module) {
+          return llvm::CloneModule(module);
+        }),
+        module.getContext());
+    module.withModuleDo([&](llvm::Module &module) {
+      split_tiers(module, source, resource_tracker);
+    });
+  }
+  if (is_lazy) {
+    // As LLLazyJIT::addLazyIRModule does, but under the given tracker.
+    module.withModuleDo([](llvm::Module &module) {
+      if (module.getDataLayout().isDefault()) {
+        module.setDataLayout(jit->getDataLayout());
+      }
+    });
+    exit_on_error(static_cast<llvm::orc::LLLazyJIT &>(*jit)
+                      .getCompileOnDemandLayer()
+                      .add(resource_tracker, std::move(module)));
+  } else {
+    exit_on_error(jit->addIRModule(resource_tracker, std::move(module)));
+  }
+}
+
+// Frees everything added under `resource_tracker`, once the tier-ups of its
+// functions that are still being compiled have finished, then the arenas only
+// its code held. Callers hold compile_mutex with `lock`, which is released
+// while waiting for them, since their compilation may need a compile thread
+// that is waiting for the lock, and while freeing the arenas.
+static void remove_code(const llvm::orc::ResourceTrackerSP &resource_tracker,
+                        std::unique_lock<std::mutex> &lock) {
+  std::vector<std::shared_ptr<TierState>> states;
+  for (auto state = tier_states.begin(); state != tier_states.end();) {
+    if (state->second->resource_tracker == resource_tracker) {
+      states.push_back(std::move(state->second));
+      state = tier_states.erase(state);
+    } else {
+      ++state;
+    }
+  }
+  if (!states.empty()) {
+    lock.unlock();
+    for (const std::shared_ptr<TierState> &state : states) {
+      state->wait_for_tier_up();
+    }
+    lock.lock();
+  }
+  exit_on_error(resource_tracker->remove());
+  auto references = arena_references.find(resource_tracker.get());
+  if (references != arena_references.end()) {
+    llvm::SmallVector<ExpressionArena *, 1> arenas =
+        std::move(references->second.arenas);
+    arena_references.erase(references);
+    // Freeing an arena takes compile_mutex.
+    lock.unlock();
+    for (ExpressionArena *arena : arenas) {
+      release_arena(arena);
+    }
+    lock.lock();
+  }
+}
+
+// What the first tier of a function has counted, as its optimized tier is
+// compiled with it. A call site whose calls nearly all went to one tiered
+// function has that function's name and its source module as bitcode.
+struct ProfiledCallSite {
+  std::uint64_t count;
+  std::uint64_t target_count;
+  std::uint64_t compile_count;
+  std::string target_name;
+  llvm::SmallVector<char, 0> target_source;
+};
+
+struct ExecutionProfile {
+  std::uint64_t entry_count;
+  std::vector<ProfiledCallSite> call_sites;
+};
+
+static std::optional<ExecutionProfile>
+get_execution_profile(const std::string &name) {
+  ExecutionProfile profile;
+  std::vector<std::shared_ptr<llvm::orc::ThreadSafeModule>> target_sources;
+  {
+    std::lock_guard lock(profiles_mutex);
+    auto found = function_profiles.find(name);
+    if (found == function_profiles.end()) {
+      return std::nullopt;
+    }
+    profile.entry_count = found->second->entry_count;
+    for (auto &call_site : found->second->call_sites) {
+      ProfiledCallSite profiled{call_site->count, call_site->target_count,
+                                call_site->compile_count, "", {}};
+      std::shared_ptr<llvm::orc::ThreadSafeModule> target_source;
+      if (profiled.count > 0 &&
+          profiled.target_count >= profiled.count - profiled.count / 10) {
+        profiled.target_name =
+            function_address_listener.get_name(call_site->target);
+        auto target = function_profiles.find(profiled.target_name);
+        if (target != function_profiles.end()) {
+          target_source = target->second->source.lock();
+        }
+      }
+      profile.call_sites.push_back(std::move(profiled));
+      target_sources.push_back(std::move(target_source));
+    }
+  }
+  for (std::size_t index = 0; index < target_sources.size(); index++) {
+    if (target_sources[index]) {
+      llvm::raw_svector_ostream os(profile.call_sites[index].target_source);
+      target_sources[index]->withModuleDo(
+          [&](llvm::Module &module) { llvm::WriteBitcodeToFile(module, os); });
+    }
+  }
+  return profile;
+}
+
+// Branch weights are 32-bit, so counts are scaled down to fit.
+static llvm::MDNode *get_branch_weights(llvm::LLVMContext &context,
+                                        std::uint64_t taken,
+                                        std::uint64_t not_taken) {
+  std::uint64_t scale =
+      std::max(taken, not_taken) / std::numeric_limits<std::uint32_t>::max() +
+      1;
+  return llvm::MDBuilder(context).createBranchWeights(taken / scale,
+                                                      not_taken / scale);
+}
+
+// Links a private copy of the call site's target into `module`. Other
+// functions of the target's source module stay declarations. Returns null if
+// linking fails, which may leave `module` partially linked.
+static llvm::Function *link_target_copy(llvm::Module &module,
+                                        const ProfiledCallSite &call_site) {
+  auto source = exit_on_error(llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(llvm::StringRef(call_site.target_source.data(),
+                                            call_site.target_source.size()),
+                            "target"),
+      module.getContext()));
+  std::string copy_name = call_site.target_name + ".inlined";
+  for (llvm::Function &function : *source) {
+    if (function.isDeclaration() || !function.hasExternalLinkage()) {
+      continue;
+    }
+    if (function.getName() == call_site.target_name) {
+      function.setName(copy_name);
+    } else {
+      function.deleteBody();
+    }
+  }
+  if (llvm::Linker::linkModules(module, std::move(source))) {
+    return nullptr;
+  }
+  llvm::Function *copy = module.getFunction(copy_name);
+  copy->setLinkage(llvm::GlobalValue::PrivateLinkage);
+  return copy;
 }
 
-Expression *Call::to_constructor() const {
-  std::vector<Expression *> parameters_type_constructor;
-  for (Type *parameter_type : parameters_type) {
-    parameters_type_constructor.push_back(
-        new Size(reinterpret_cast<std::size_t>(parameter_type)));
+// Removes the counting instrument_module has added. Instructions are removed
+// in reverse, since the instrumentation only uses earlier instrumentation.
+static void strip_instrumentation(llvm::Module &module) {
+  unsigned kind = module.getContext().getMDKindID("jit.profile");
+  std::vector<llvm::Instruction *> instrumentation;
+  for (llvm::Function &function : module) {
+    for (llvm::Instruction &instruction : llvm::instructions(function)) {
+      if (instruction.getMetadata(kind)) {
+        instrumentation.push_back(&instruction);
+      }
+    }
   }
-  std::vector<Expression *> arguments_constructor;
-  for (Expression *argument : arguments) {
-    arguments_constructor.push_back(argument->to_constructor());
-  }
-  return new Call(new Function("create_call", get_size_type(),
-                               {
-                                   get_size_type(),
-                                   get_size_type(),
-                                   get_size_type(),
-                                   get_size_type(),
-                                   get_boolean_type(),
-                                   get_size_type(),
-                               },
-                               false),
-                  get_size_type(),
-                  {
-                      get_size_type(),
-                      get_size_type(),
-                      get_size_type(),
-                      get_size_type(),
-                      get_boolean_type(),
-                      get_size_type(),
-                  },
-                  false,
-                  {new Size(reinterpret_cast<std::size_t>(function)),
-                   new Size(reinterpret_cast<std::size_t>(return_type)),
-                   new Size(parameters_type.size()),
-                   new Array(get_size_type(), parameters_type_constructor),
-                   new Boolean(is_variadic),
-                   new Array(get_size_type(), arguments_constructor)});
-}
-
-extern "C" Call *create_call(Expression *function, Type *return_type,
-                             std::size_t num_parameters, Type **parameters_type,
-                             bool is_variadic, Expression **arguments) {
-  std::vector<Type *> vec_parameters_type;
-  std::vector<Expression *> vec_arguments;
-  for (std::size_t parameter_index = 0; parameter_index < num_parameters;
-       parameter_index++) {
-    vec_parameters_type.push_back(parameters_type[parameter_index]);
-    vec_arguments.push_back(arguments[parameter_index]);
+  for (auto instruction = instrumentation.rbegin();
+       instruction != instrumentation.rend(); ++instruction) {
+    (*instruction)->eraseFromParent();
   }
-  return new Call(function, return_type, vec_parameters_type, is_variadic,
-                  vec_arguments);
 }
 
-extern "C" void initialize_jit() {
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::orc::LLJITBuilder jit_builder;
-  jit = exit_on_error(jit_builder.create());
-  char global_prefix = jit->getDataLayout().getGlobalPrefix();
-  auto generator = exit_on_error(
-      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
-          global_prefix));
-  jit->getMainJITDylib().addGenerator(std::move(generator));
+// Gives the optimized tier of a function its entry count and the weights of
+// the branches to call sites' compile paths, from how often the cache missed,
+// and turns each call site with a single hot target into a guarded direct
+// call to a copy of the target, which the inliner can then inline. Returns
+// false if a copy fails to link, leaving the module unusable.
+static bool apply_profile(llvm::Function &function,
+                          const ExecutionProfile &profile) {
+  llvm::Module &module = *function.getParent();
+  llvm::LLVMContext &context = module.getContext();
+  function.setEntryCount(llvm::Function::ProfileCount(
+      profile.entry_count, llvm::Function::PCT_Real));
+  std::map<std::size_t, llvm::CallInst *> calls;
+  for (llvm::Instruction &instruction : llvm::instructions(function)) {
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(&instruction)) {
+      if (llvm::MDNode *call_site = call->getMetadata("jit.call_site")) {
+        calls[llvm::mdconst::extract<llvm::ConstantInt>(
+                  call_site->getOperand(0))
+                  ->getZExtValue()] = call;
+      }
+    }
+  }
+  for (auto &[index, call] : calls) {
+    llvm::BasicBlock *compile_block = get_compile_block(*call);
+    if (index >= profile.call_sites.size() || !compile_block) {
+      continue;
+    }
+    const ProfiledCallSite &call_site = profile.call_sites[index];
+    llvm::BasicBlock *lookup_block = compile_block->getSinglePredecessor();
+    if (call_site.count == 0 || !lookup_block) {
+      continue;
+    }
+    // The counters are read one at a time while calls go on.
+    std::uint64_t compile_count =
+        std::min(call_site.compile_count, call_site.count);
+    auto branch =
+        llvm::dyn_cast<llvm::BranchInst>(lookup_block->getTerminator());
+    if (branch && branch->isConditional()) {
+      branch->setMetadata(
+          llvm::LLVMContext::MD_prof,
+          get_branch_weights(context, compile_count,
+                             call_site.count - compile_count));
+    }
+  }
+  std::map<std::string, llvm::Function *> copies;
+  for (auto &[index, call] : calls) {
+    if (index >= profile.call_sites.size()) {
+      continue;
+    }
+    const ProfiledCallSite &call_site = profile.call_sites[index];
+    if (call_site.target_source.empty() || call->getCalledFunction()) {
+      continue;
+    }
+    llvm::Function *&copy = copies[call_site.target_name];
+    if (!copy) {
+      copy = link_target_copy(module, call_site);
+      if (!copy) {
+        return false;
+      }
+    }
+    if (copy->getFunctionType() != call->getFunctionType()) {
+      continue;
+    }
+    llvm::FunctionCallee target = module.getOrInsertFunction(
+        call_site.target_name, call->getFunctionType());
+    // Compares against the target itself and calls the copy when it matches.
+    llvm::CallBase &direct_call = llvm::promoteCallWithIfThenElse(
+        *call, llvm::cast<llvm::Function>(target.getCallee()),
+        get_branch_weights(context, call_site.target_count,
+                           call_site.count - call_site.target_count));
+    direct_call.setCalledFunction(copy);
+  }
+  strip_instrumentation(module);
+  return true;
 }
 
-extern "C" void *compile_expression(Expression *expression, Type *return_type,
-                                    std::size_t num_parameters,
-                                    Type **parameters_type) {
-  if (!expression->pointer) {
-    std::stringstream function_name_builder;
-    function_name_builder << expression;
-    std::string function_name = function_name_builder.str();
-    auto context = std::make_unique<llvm::LLVMContext>();
-    llvm::Type *llvm_return_type = return_type->into_llvm_type(*context);
+// A function whose tier-up fails keeps running its first tier.
+static void report_tier_up_error(TierState &state, llvm::Error error) {
+  llvm::logAllUnhandledErrors(std::move(error), llvm::errs(),
+                              "tier-up of " + state.name + ": ");
+  state.finish_tier_up();
+}
+
+// Emits `f.tier2`, a copy of `f` from the source module at -O3, and patches
+// `f.implementation` to it once it has been materialized. Runs on a compile
+// thread, and never takes compile_mutex.
+static void compile_tier_up(const std::shared_ptr<TierState> &state,
+                            void **implementation) {
+  std::string optimized_name = state->name + ".tier2";
+  std::optional<ExecutionProfile> profile;
+  if (jit_options.profile_guided_recompilation) {
+    profile = get_execution_profile(state->name);
+  }
+  auto module = state->source->withModuleDo([&](llvm::Module &source) {
+    llvm::ValueToValueMapTy value_map;
+    // Other tiered functions stay declarations and are reached through their
+    // own stubs; everything private to the source module is copied.
+    auto module = llvm::CloneModule(
+        source, value_map, [state](const llvm::GlobalValue *value) {
+          return !llvm::isa<llvm::Function>(value) ||
+                 !value->hasExternalLinkage() ||
+                 value->getName() == state->name;
+        });
+    module->getFunction(state->name)->setName(optimized_name);
+    if (profile) {
+      // The profile is applied to a scratch copy, which is only kept if every
+      // target copy links; otherwise the optimized tier goes without it.
+      auto profiled = llvm::CloneModule(*module);
+      if (apply_profile(*profiled->getFunction(optimized_name), *profile)) {
+        module = std::move(profiled);
+      } else {
+        strip_instrumentation(*module);
+      }
+    }
+    module->addModuleFlag(llvm::Module::Override, "jit.opt_level", 3u);
+    return module;
+  });
+  if (llvm::Error error = jit->addIRModule(
+          state->resource_tracker,
+          llvm::orc::ThreadSafeModule(std::move(module),
+                                      state->source->getContext()))) {
+    report_tier_up_error(*state, std::move(error));
+    return;
+  }
+
+  llvm::orc::SymbolLookupSet symbols(jit->mangleAndIntern(optimized_name));
+  jit->getExecutionSession().lookup(
+      llvm::orc::LookupKind::Static,
+      llvm::orc::makeJITDylibSearchOrder(
+          &jit->getMainJITDylib(),
+          llvm::orc::JITDylibLookupFlags::MatchAllSymbols),
+      std::move(symbols), llvm::orc::SymbolState::Ready,
+      [state, implementation](llvm::Expected<llvm::orc::SymbolMap> addresses) {
+        if (!addresses) {
+          report_tier_up_error(*state, addresses.takeError());
+          return;
+        }
+        void *optimized =
+            addresses->begin()->second.getAddress().toPtr<void *>();
+        reinterpret_cast<std::atomic<void *> *>(implementation)
+            ->store(optimized, std::memory_order_release);
+        state->tier = 2;
+        state->finish_tier_up();
+      },
+      llvm::orc::NoDependenciesToRegister);
+}
+
+// Called by first-tier code when it becomes hot. The profile, the copy of the
+// source module and the linking of profiled targets are left to a compile
+// thread, so the hot call returns at once.
+extern "C" void tier_up(TierState *hot_state, void **implementation) {
+  std::shared_ptr<TierState> state = hot_state->shared_from_this();
+  jit->getExecutionSession().dispatchTask(llvm::orc::makeGenericNamedTask(
+      [state, implementation] { compile_tier_up(state, implementation); },
+      "tier-up"));
+}
+
+// Callers hold compile_mutex.
+static int get_tier(const std::string &name) {
+  auto state = tier_states.find(name);
+  return state == tier_states.end() ? 0 : state->second->tier.load();
+}
+
+CompileQueue::CompileQueue()
+    : context(std::make_unique<llvm::LLVMContext>()), batch_limit(64),
+      batch_delay(0) {}
+
+// Expression functions are numbered in the order they are first named rather
+// than named after their address, so that a program that compiles the same
+// expressions in the same order emits the same modules in every run, and the
+// object cache can recognize them. A label from set_expression_name follows
+// the number.
+static std::string get_function_name(const Expression *expression) {
+  auto inserted = function_names.try_emplace(expression, "");
+  if (inserted.second) {
+    inserted.first->second =
+        "expression." + std::to_string(num_function_names++);
+    auto label = expression_labels.find(expression);
+    if (label != expression_labels.end()) {
+      inserted.first->second += "." + label->second;
+    }
+  }
+  return inserted.first->second;
+}
+
+// An expression whose code has a signature already is named at once.
+extern "C" void set_expression_name(Expression *expression, const char *name) {
+  std::lock_guard lock(compile_mutex);
+  expression_labels.try_emplace(expression, name);
+  if (expression->signature) {
+    get_function_name(get_canonical(expression, expression->signature));
+  }
+}
+
+static bool is_staged(Expression *expression) {
+  return compile_queue.pending.count(expression) != 0 ||
+         compile_queue.submitted.count(expression) != 0 ||
+         compile_queue.resolving.count(expression) != 0;
+}
+
+// The functions below up to compile_expression expect compile_mutex to be
+// held.
+
+static void flush_pending_expressions() {
+  if (compile_queue.pending.empty()) {
+    return;
+  }
+  // compile_queue.module->print(llvm::outs(), nullptr);
+  auto compiled_module = std::make_shared<CompiledModule>(CompiledModule{
+      jit->getMainJITDylib().createResourceTracker(),
+      compile_queue.pending.size()});
+  for (Expression *expression : compile_queue.pending) {
+    compiled_modules[expression] = compiled_module;
+  }
+  add_module(llvm::orc::ThreadSafeModule(std::move(compile_queue.module),
+                                         compile_queue.context),
+             compiled_module->resource_tracker);
+  compile_queue.submitted.insert(compile_queue.pending.begin(),
+                                 compile_queue.pending.end());
+  compile_queue.pending.clear();
+}
+
+static bool
+has_batch_delay_passed(std::chrono::steady_clock::time_point now) {
+  return compile_queue.batch_delay.count() > 0 &&
+         !compile_queue.pending.empty() &&
+         now - compile_queue.oldest_pending_time >= compile_queue.batch_delay;
+}
+
+// Flushes the pending batch once its oldest expression has waited for
+// `batch_delay`, as no thread may stage or compile anything to notice. Runs
+// from the first nonzero set_compile_batch_delay until exit.
+class BatchDelayTimer {
+  std::thread thread;
+  bool is_stopping = false;
+
+  void run();
+
+public:
+  // Notified whenever the deadline may have moved.
+  std::condition_variable deadline_changed;
+  ~BatchDelayTimer();
+  void start();
+};
+
+void BatchDelayTimer::run() {
+  std::unique_lock lock(compile_mutex);
+  while (!is_stopping) {
+    if (compile_queue.batch_delay.count() == 0 ||
+        compile_queue.pending.empty()) {
+      deadline_changed.wait(lock);
+    } else if (has_batch_delay_passed(std::chrono::steady_clock::now())) {
+      flush_pending_expressions();
+    } else {
+      deadline_changed.wait_until(lock, compile_queue.oldest_pending_time +
+                                            compile_queue.batch_delay);
+    }
+  }
+}
+
+void BatchDelayTimer::start() {
+  if (!thread.joinable()) {
+    thread = std::thread([this] { run(); });
+  }
+}
+
+BatchDelayTimer::~BatchDelayTimer() {
+  if (!thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard lock(compile_mutex);
+    is_stopping = true;
+  }
+  deadline_changed.notify_all();
+  thread.join();
+}
+
+static BatchDelayTimer batch_delay_timer;
+
+static void stage_canonical_expression(Expression *expression,
+                                       Type *return_type,
+                                       std::size_t num_parameters,
+                                       Type **parameters_type) {
+  if (expression->pointer || is_staged(expression)) {
+    return;
+  }
+  {
+    PhaseTimer timer(CompilePhase::IrBuild, get_function_name(expression));
+    auto lock = compile_queue.context.getLock();
+    llvm::LLVMContext &context = *compile_queue.context.getContext();
+    if (!compile_queue.module) {
+      compile_queue.module = std::make_unique<llvm::Module>("", context);
+    }
+    llvm::Type *llvm_return_type = return_type->into_llvm_type(context);
     std::vector<llvm::Type *> llvm_parameters_type;
     for (std::size_t parameter_index = 0; parameter_index < num_parameters;
          parameter_index++) {
       llvm_parameters_type.push_back(
-          parameters_type[parameter_index]->into_llvm_type(*context));
+          parameters_type[parameter_index]->into_llvm_type(context));
     }
     llvm::FunctionType *function_type =
         llvm::FunctionType::get(llvm_return_type, llvm_parameters_type, false);
-    auto module = std::make_unique<llvm::Module>("", *context);
     llvm::Function *function = llvm::Function::Create(
-        function_type, llvm::Function::ExternalLinkage, function_name, *module);
-    llvm::IRBuilder builder(*context);
+        function_type, llvm::Function::ExternalLinkage,
+        get_function_name(expression), *compile_queue.module);
+    llvm::IRBuilder builder(context);
     llvm::BasicBlock *basic_block =
-        llvm::BasicBlock::Create(*context, "", function);
+        llvm::BasicBlock::Create(context, "", function);
     builder.SetInsertPoint(basic_block);
-    llvm::Value *ret = expression->codegen(builder);
+    llvm::Value *ret = codegen_simplified(builder, expression);
     builder.CreateRet(ret);
-    // module->print(llvm::outs(), nullptr);
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (compile_queue.pending.empty()) {
+    compile_queue.oldest_pending_time = now;
+    batch_delay_timer.deadline_changed.notify_one();
+  }
+  compile_queue.pending.insert(expression);
+  if (compile_queue.pending.size() >= compile_queue.batch_limit ||
+      has_batch_delay_passed(now)) {
+    flush_pending_expressions();
+  }
+}
+
+// Looks up every submitted expression at once, so that all of the modules
+// they live in are materialized by a single lookup. The lock is released
+// during the lookup, so that other threads can stage, compile and wait
+// meanwhile.
+static void
+resolve_submitted_expressions(std::unique_lock<std::mutex> &lock) {
+  if (compile_queue.submitted.empty()) {
+    return;
+  }
+  std::vector<std::pair<Expression *, llvm::orc::SymbolStringPtr>> batch;
+  llvm::orc::SymbolLookupSet symbols;
+  for (Expression *expression : compile_queue.submitted) {
+    auto symbol = jit->mangleAndIntern(get_function_name(expression));
+    symbols.add(symbol);
+    batch.emplace_back(expression, symbol);
+    compile_queue.resolving.insert(expression);
+  }
+  compile_queue.submitted.clear();
+  lock.unlock();
+  llvm::orc::SymbolMap addresses;
+  {
+    PhaseTimer timer(CompilePhase::Lookup,
+                     std::to_string(batch.size()) + " expressions");
+    addresses = exit_on_error(jit->getExecutionSession().lookup(
+        llvm::orc::makeJITDylibSearchOrder(
+            &jit->getMainJITDylib(),
+            llvm::orc::JITDylibLookupFlags::MatchAllSymbols),
+        std::move(symbols)));
+  }
+  lock.lock();
+  for (auto &[expression, symbol] : batch) {
+    // Expressions whose arena has been released meanwhile are left alone.
+    if (compile_queue.resolving.erase(expression)) {
+      expression->pointer.store(
+          addresses[symbol].getAddress().toPtr<void *>(),
+          std::memory_order_release);
+    }
+  }
+  compile_finished.notify_all();
+}
+
+extern "C" void set_compile_batch_limit(std::size_t batch_limit) {
+  std::lock_guard lock(compile_mutex);
+  compile_queue.batch_limit = batch_limit;
+  if (compile_queue.pending.size() >= compile_queue.batch_limit) {
+    flush_pending_expressions();
+  }
+}
+
+extern "C" void set_compile_batch_delay(std::size_t microseconds) {
+  std::lock_guard lock(compile_mutex);
+  compile_queue.batch_delay = std::chrono::microseconds(microseconds);
+  if (has_batch_delay_passed(std::chrono::steady_clock::now())) {
+    flush_pending_expressions();
+  }
+  if (microseconds > 0) {
+    batch_delay_timer.start();
+  }
+  batch_delay_timer.deadline_changed.notify_one();
+}
+
+extern "C" void stage_expression(Expression *expression, Type *return_type,
+                                 std::size_t num_parameters,
+                                 Type **parameters_type) {
+  std::lock_guard lock(compile_mutex);
+  stage_canonical_expression(
+      get_canonical(expression, get_signature(return_type, num_parameters,
+                                              parameters_type)),
+      return_type, num_parameters, parameters_type);
+}
+
+extern "C" void flush_compile_queue() {
+  std::lock_guard lock(compile_mutex);
+  flush_pending_expressions();
+}
+
+// Compiles the staged canonical expression on this thread, or waits for the
+// thread that is already doing so.
+static void wait_for_code(Expression *canonical,
+                          std::unique_lock<std::mutex> &lock) {
+  while (!canonical->pointer) {
+    if (compile_queue.pending.count(canonical)) {
+      flush_pending_expressions();
+    }
+    if (compile_queue.submitted.count(canonical)) {
+      resolve_submitted_expressions(lock);
+    } else {
+      compile_finished.wait(lock);
+    }
+  }
+}
+
+// Compiled expressions are read without locking. Otherwise, the calling thread
+// compiles the expression, or waits for the thread that is already doing so.
+// An expression only keeps the code of its first signature; asking for another
+// one takes the lock every time.
+extern "C" void *compile_expression(Expression *expression, Type *return_type,
+                                    std::size_t num_parameters,
+                                    Type **parameters_type) {
+  if (void *pointer = expression->pointer.load(std::memory_order_acquire)) {
+    if (has_signature(expression, return_type, num_parameters,
+                      parameters_type)) {
+      return pointer;
+    }
+  }
+  if (expression->kind() == ExpressionKind::ReadyMade) {
+    static_cast<ReadyMade *>(expression)->resolve();
+    return expression->pointer;
+  }
+  std::unique_lock lock(compile_mutex);
+  const Signature *signature =
+      get_signature(return_type, num_parameters, parameters_type);
+  Expression *canonical = get_canonical(expression, signature);
+  if (canonical->pointer) {
+    expression_cache_stats.code_hits++;
+  } else {
+    expression_cache_stats.code_misses++;
+    stage_canonical_expression(canonical, return_type, num_parameters,
+                               parameters_type);
+    wait_for_code(canonical, lock);
+  }
+  void *pointer = canonical->pointer.load(std::memory_order_acquire);
+  if (expression != canonical && bind_signature(expression, signature)) {
+    pointer_copies[canonical].insert(expression);
+    expression->pointer.store(pointer, std::memory_order_release);
+  }
+  return pointer;
+}
+
+// The entry is looked up again under the lock, so that it is only created for
+// code that has not been released since compile_expression returned it.
+extern "C" void *resolve_call_site(std::atomic<CallSiteEntry *> *cache,
+                                   Expression *callee, Type *return_type,
+                                   std::size_t num_parameters,
+                                   Type **parameters_type) {
+  void *target = compile_expression(callee, return_type, num_parameters,
+                                    parameters_type);
+  std::lock_guard lock(compile_mutex);
+  const Signature *signature =
+      get_signature(return_type, num_parameters, parameters_type);
+  std::unique_ptr<CallSiteEntry> &entry =
+      call_site_entries[{callee, signature}];
+  if (!entry) {
+    if (callee->kind() != ExpressionKind::ReadyMade) {
+      Expression *canonical = get_canonical(callee, signature);
+      if (canonical->pointer.load(std::memory_order_relaxed) != target) {
+        call_site_entries.erase({callee, signature});
+        return target;
+      }
+      call_site_callees[canonical].insert(callee);
+    }
+    entry = std::make_unique<CallSiteEntry>();
+    entry->key.store(reinterpret_cast<std::size_t>(callee),
+                     std::memory_order_relaxed);
+    entry->target = target;
+  }
+  cache->store(entry.get(), std::memory_order_release);
+  return target;
+}
+
+// Emits `name`, which loops over the rows of its columns and calls a private
+// copy of the scalar function of `expression` for each. The copy is always
+// inlined, so the loop vectorizer sees the expression itself; `results` may
+// not alias the columns.
+static void emit_batch_function(llvm::Module &module, const std::string &name,
+                                Expression *expression, Type *return_type,
+                                std::size_t num_parameters,
+                                Type **parameters_type) {
+  llvm::LLVMContext &context = module.getContext();
+  llvm::Type *llvm_return_type = return_type->into_llvm_type(context);
+  llvm::Type *llvm_size_type = get_size_type()->into_llvm_type(context);
+  std::vector<llvm::Type *> llvm_parameters_type;
+  for (std::size_t parameter_index = 0; parameter_index < num_parameters;
+       parameter_index++) {
+    llvm_parameters_type.push_back(
+        parameters_type[parameter_index]->into_llvm_type(context));
+  }
+  llvm::Function *row = llvm::Function::Create(
+      llvm::FunctionType::get(llvm_return_type, llvm_parameters_type, false),
+      llvm::Function::PrivateLinkage, name + ".row", module);
+  row->addFnAttr(llvm::Attribute::AlwaysInline);
+  llvm::IRBuilder builder(context);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "", row));
+  builder.CreateRet(codegen_simplified(builder, expression));
+
+  llvm::Type *column_type =
+      llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(context));
+  llvm::Type *results_type = llvm::PointerType::getUnqual(llvm_return_type);
+  llvm::Function *batch = llvm::Function::Create(
+      llvm::FunctionType::get(
+          llvm::Type::getVoidTy(context),
+          {llvm_size_type, llvm::PointerType::getUnqual(column_type),
+           results_type},
+          false),
+      llvm::Function::ExternalLinkage, name, module);
+  batch->addParamAttr(1, llvm::Attribute::ReadOnly);
+  batch->addParamAttr(2, llvm::Attribute::NoAlias);
+  llvm::Value *count = batch->getArg(0);
+  llvm::Value *results = batch->getArg(2);
+  llvm::BasicBlock *entry = llvm::BasicBlock::Create(context, "", batch);
+  llvm::BasicBlock *loop = llvm::BasicBlock::Create(context, "loop", batch);
+  llvm::BasicBlock *exit = llvm::BasicBlock::Create(context, "exit", batch);
+
+  builder.SetInsertPoint(entry);
+  std::vector<llvm::Value *> columns;
+  for (std::size_t parameter_index = 0; parameter_index < num_parameters;
+       parameter_index++) {
+    llvm::Value *column = builder.CreateLoad(
+        column_type,
+        builder.CreateConstGEP1_64(column_type, batch->getArg(1),
+                                   parameter_index));
+    columns.push_back(builder.CreatePointerCast(
+        column,
+        llvm::PointerType::getUnqual(llvm_parameters_type[parameter_index])));
+  }
+  builder.CreateCondBr(builder.CreateICmpEQ(
+                           count, llvm::ConstantInt::get(llvm_size_type, 0)),
+                       exit, loop);
+
+  builder.SetInsertPoint(loop);
+  llvm::PHINode *index = builder.CreatePHI(llvm_size_type, 2);
+  index->addIncoming(llvm::ConstantInt::get(llvm_size_type, 0), entry);
+  std::vector<llvm::Value *> arguments;
+  for (std::size_t parameter_index = 0; parameter_index < num_parameters;
+       parameter_index++) {
+    llvm::Type *element_type = llvm_parameters_type[parameter_index];
+    arguments.push_back(builder.CreateLoad(
+        element_type,
+        builder.CreateInBoundsGEP(element_type, columns[parameter_index],
+                                  index)));
+  }
+  builder.CreateStore(
+      builder.CreateCall(row, arguments),
+      builder.CreateInBoundsGEP(llvm_return_type, results, index));
+  llvm::Value *next_index =
+      builder.CreateAdd(index, llvm::ConstantInt::get(llvm_size_type, 1));
+  index->addIncoming(next_index, loop);
+  builder.CreateCondBr(builder.CreateICmpEQ(next_index, count), exit, loop);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+}
+
+// Batch functions are compiled once per canonical expression like scalar
+// ones, but each in a module of its own, since the scalar code has to be
+// inlined into the loop.
+extern "C" void *compile_expression_batch(Expression *expression,
+                                          Type *return_type,
+                                          std::size_t num_parameters,
+                                          Type **parameters_type) {
+  std::unique_lock lock(compile_mutex);
+  Expression *canonical = get_canonical(
+      expression, get_signature(return_type, num_parameters, parameters_type));
+  while (compiling_batches.count(canonical)) {
+    compile_finished.wait(lock);
+  }
+  auto found = batch_functions.find(canonical);
+  if (found != batch_functions.end()) {
+    return found->second;
+  }
+  compiling_batches.insert(canonical);
+  std::string name = get_function_name(canonical) + ".batch";
+  auto context = std::make_unique<llvm::LLVMContext>();
+  auto module = std::make_unique<llvm::Module>("", *context);
+  {
+    PhaseTimer timer(CompilePhase::IrBuild, name);
+    emit_batch_function(*module, name, canonical, return_type, num_parameters,
+                        parameters_type);
+  }
+  auto resource_tracker = jit->getMainJITDylib().createResourceTracker();
+  add_module(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)),
+             resource_tracker);
+  lock.unlock();
+  void *batch;
+  {
+    PhaseTimer timer(CompilePhase::Lookup, name);
+    batch = exit_on_error(jit->lookup(name)).toPtr<void *>();
+  }
+  lock.lock();
+  // Nothing is recorded if the expression's arena was released meanwhile.
+  if (compiling_batches.erase(canonical)) {
+    batch_functions[canonical] = batch;
+    batch_resource_trackers[canonical] = resource_tracker;
+  }
+  compile_finished.notify_all();
+  return batch;
+}
+
+// An expression still being compiled is compiled to the end first, so that no
+// lookup is in flight when its code is freed. The expression gets a new
+// function name, since the old one stays defined until the whole module is
+// freed.
+static void release_canonical_expression(Expression *canonical,
+                                         std::unique_lock<std::mutex> &lock) {
+  if (is_staged(canonical)) {
+    wait_for_code(canonical, lock);
+  }
+  while (compiling_batches.count(canonical)) {
+    compile_finished.wait(lock);
+  }
+  canonical->pointer.store(nullptr, std::memory_order_release);
+  auto callees = call_site_callees.find(canonical);
+  if (callees != call_site_callees.end()) {
+    for (const Expression *callee : callees->second) {
+      retire_call_site_entry(callee, canonical->signature);
+    }
+    call_site_callees.erase(callees);
+  }
+  auto copies = pointer_copies.find(canonical);
+  if (copies != pointer_copies.end()) {
+    for (Expression *copy : copies->second) {
+      copy->pointer.store(nullptr, std::memory_order_release);
+    }
+    pointer_copies.erase(copies);
+  }
+  function_names.erase(canonical);
+  evaluation_counts.erase(canonical);
+  batch_functions.erase(canonical);
+  // remove_code may release the lock, so the tables are updated first.
+  std::vector<llvm::orc::ResourceTrackerSP> resource_trackers;
+  auto batch_resource_tracker = batch_resource_trackers.find(canonical);
+  if (batch_resource_tracker != batch_resource_trackers.end()) {
+    resource_trackers.push_back(std::move(batch_resource_tracker->second));
+    batch_resource_trackers.erase(batch_resource_tracker);
+  }
+  auto compiled_module = compiled_modules.find(canonical);
+  if (compiled_module != compiled_modules.end()) {
+    if (--compiled_module->second->num_expressions == 0) {
+      resource_trackers.push_back(compiled_module->second->resource_tracker);
+    }
+    compiled_modules.erase(compiled_module);
+  }
+  for (const llvm::orc::ResourceTrackerSP &resource_tracker :
+       resource_trackers) {
+    remove_code(resource_tracker, lock);
+  }
+}
+
+extern "C" void release_expression(Expression *expression) {
+  std::unique_lock lock(compile_mutex);
+  std::vector<Expression *> canonicals;
+  for (const Signature &signature : signatures) {
+    auto found = canonical_expressions.find({expression, &signature});
+    if (found != canonical_expressions.end()) {
+      canonicals.push_back(found->first);
+    }
+  }
+  for (Expression *canonical : canonicals) {
+    release_canonical_expression(canonical, lock);
+  }
+}
+
+// Emits `name`, which calls the function of the given signature that its
+// first argument points to, taking the arguments from an array of
+// RuntimeValue and storing the result to another:
+//   void (void *function, const RuntimeValue *arguments, RuntimeValue *result)
+static void emit_trampoline(llvm::Module &module, const std::string &name,
+                            Type *return_type,
+                            llvm::ArrayRef<Type *> parameters_type) {
+  llvm::LLVMContext &context = module.getContext();
+  llvm::Type *llvm_return_type = return_type->into_llvm_type(context);
+  std::vector<llvm::Type *> llvm_parameters_type;
+  for (Type *parameter_type : parameters_type) {
+    llvm_parameters_type.push_back(parameter_type->into_llvm_type(context));
+  }
+  llvm::FunctionType *function_type =
+      llvm::FunctionType::get(llvm_return_type, llvm_parameters_type, false);
+  llvm::Type *byte_type = llvm::Type::getInt8Ty(context);
+  llvm::Type *pointer_type = llvm::PointerType::getUnqual(byte_type);
+  llvm::Function *trampoline = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(context),
+                              {pointer_type, pointer_type, pointer_type},
+                              false),
+      llvm::Function::ExternalLinkage, name, module);
+  llvm::IRBuilder builder(context);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "", trampoline));
+  std::vector<llvm::Value *> arguments;
+  for (std::size_t parameter_index = 0;
+       parameter_index < parameters_type.size(); parameter_index++) {
+    llvm::Type *parameter_type = llvm_parameters_type[parameter_index];
+    llvm::Value *slot = builder.CreateConstGEP1_64(
+        byte_type, trampoline->getArg(1),
+        parameter_index * sizeof(RuntimeValue));
+    arguments.push_back(builder.CreateLoad(
+        parameter_type,
+        builder.CreatePointerCast(
+            slot, llvm::PointerType::getUnqual(parameter_type))));
+  }
+  llvm::Value *function = builder.CreatePointerCast(
+      trampoline->getArg(0), llvm::PointerType::getUnqual(function_type));
+  llvm::Value *result = builder.CreatePointerCast(
+      trampoline->getArg(2), llvm::PointerType::getUnqual(llvm_return_type));
+  builder.CreateStore(builder.CreateCall(function_type, function, arguments),
+                      result);
+  builder.CreateRetVoid();
+}
+
+using Trampoline = void (*)(void *, const RuntimeValue *, RuntimeValue *);
+
+// Trampolines are compiled once per signature, so that the interpreter can
+// call compiled and ready-made functions of any scalar signature.
+static Trampoline get_trampoline(Type *return_type,
+                                 llvm::ArrayRef<Type *> parameters_type) {
+  std::vector<Type *> signature{return_type};
+  signature.insert(signature.end(), parameters_type.begin(),
+                   parameters_type.end());
+  std::lock_guard lock(trampolines_mutex);
+  void *&trampoline = trampolines[signature];
+  if (!trampoline) {
+    std::string name = "trampoline." + std::to_string(trampolines.size() - 1);
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = std::make_unique<llvm::Module>("", *context);
+    {
+      PhaseTimer timer(CompilePhase::IrBuild, name);
+      emit_trampoline(*module, name, return_type, parameters_type);
+    }
     exit_on_error(jit->addIRModule(
         llvm::orc::ThreadSafeModule(std::move(module), std::move(context))));
-    auto address = exit_on_error(jit->lookup(function_name));
-    expression->pointer = address.toPtr<void *>();
+    PhaseTimer timer(CompilePhase::Lookup, name);
+    trampoline = exit_on_error(jit->lookup(name)).toPtr<void *>();
+  }
+  return reinterpret_cast<Trampoline>(trampoline);
+}
+
+// Interprets the expression while it is cold and the interpreter can run it,
+// and calls its compiled code otherwise. Only the canonical expression is
+// counted, so structurally equal expressions share their count.
+static RuntimeValue call_expression(Expression *expression, Type *return_type,
+                                    llvm::ArrayRef<Type *> parameters_type,
+                                    llvm::ArrayRef<RuntimeValue> arguments,
+                                    llvm::BumpPtrAllocator &allocator) {
+  auto parameters_type_data = const_cast<Type **>(parameters_type.data());
+  void *function = expression->pointer.load(std::memory_order_acquire);
+  if (function && !has_signature(expression, return_type,
+                                 parameters_type.size(),
+                                 parameters_type_data)) {
+    function = nullptr;
+  }
+  if (!function && expression->kind() != ExpressionKind::ReadyMade) {
+    bool is_cold = false;
+    {
+      std::lock_guard lock(compile_mutex);
+      Expression *canonical = get_canonical(
+          expression, get_signature(return_type, parameters_type.size(),
+                                    parameters_type_data));
+      if (!canonical->pointer) {
+        std::size_t &count = evaluation_counts[canonical];
+        is_cold = count++ < jit_options.interpreter_threshold;
+      }
+    }
+    if (is_cold && expression->can_evaluate()) {
+      Interpreter interpreter{parameters_type, arguments, allocator};
+      return expression->evaluate(interpreter);
+    }
+  }
+  if (!function) {
+    function = compile_expression(expression, return_type,
+                                  parameters_type.size(), parameters_type_data);
+  }
+  RuntimeValue result;
+  get_trampoline(return_type, parameters_type)(function, arguments.data(),
+                                               &result);
+  return result;
+}
+
+extern "C" void evaluate_expression(Expression *expression, Type *return_type,
+                                    std::size_t num_parameters,
+                                    Type **parameters_type,
+                                    const RuntimeValue *arguments,
+                                    RuntimeValue *result) {
+  llvm::BumpPtrAllocator allocator;
+  *result = call_expression(
+      expression, return_type,
+      llvm::ArrayRef<Type *>(parameters_type, num_parameters),
+      llvm::ArrayRef<RuntimeValue>(arguments, num_parameters), allocator);
+}
+
+CompileHandle::CompileHandle(CompileCallback callback, void *user_data)
+    : function(nullptr), is_finished(false), callback(callback),
+      user_data(user_data) {}
+
+// Notifies while holding the mutex, since a waiter may delete the handle as
+// soon as it sees the function.
+void CompileHandle::finish(void *function) {
+  if (callback) {
+    callback(user_data, function);
+  }
+  std::lock_guard lock(mutex);
+  this->function.store(function, std::memory_order_release);
+  is_finished.store(true, std::memory_order_release);
+  finished.notify_all();
+}
+
+void CompileHandle::fail(llvm::Error error) {
+  this->error = llvm::toString(std::move(error));
+  finish(nullptr);
+}
+
+// The expression is staged and its module handed to the JIT at once, but its
+// code is looked up on its own rather than with the submitted batch, so that
+// the caller does not wait for the batch either.
+extern "C" CompileHandle *
+compile_expression_async(Expression *expression, Type *return_type,
+                         std::size_t num_parameters, Type **parameters_type,
+                         CompileCallback callback, void *user_data) {
+  auto handle = new CompileHandle(callback, user_data);
+  void *pointer = expression->pointer.load(std::memory_order_acquire);
+  if (pointer && has_signature(expression, return_type, num_parameters,
+                               parameters_type)) {
+    handle->finish(pointer);
+    return handle;
+  }
+  if (expression->kind() == ExpressionKind::ReadyMade) {
+    static_cast<ReadyMade *>(expression)->resolve();
+    handle->finish(expression->pointer);
+    return handle;
   }
-  return expression->pointer;
+  std::unique_lock lock(compile_mutex);
+  Expression *canonical = get_canonical(
+      expression, get_signature(return_type, num_parameters, parameters_type));
+  if (void *pointer = canonical->pointer.load(std::memory_order_acquire)) {
+    expression_cache_stats.code_hits++;
+    lock.unlock();
+    handle->finish(pointer);
+    return handle;
+  }
+  expression_cache_stats.code_misses++;
+  stage_canonical_expression(canonical, return_type, num_parameters,
+                             parameters_type);
+  if (compile_queue.pending.count(canonical)) {
+    flush_pending_expressions();
+  }
+  std::string name = get_function_name(canonical);
+  lock.unlock();
+  jit->getExecutionSession().lookup(
+      llvm::orc::LookupKind::Static,
+      llvm::orc::makeJITDylibSearchOrder(
+          &jit->getMainJITDylib(),
+          llvm::orc::JITDylibLookupFlags::MatchAllSymbols),
+      llvm::orc::SymbolLookupSet(jit->mangleAndIntern(name)),
+      llvm::orc::SymbolState::Ready,
+      [handle, canonical,
+       name](llvm::Expected<llvm::orc::SymbolMap> addresses) {
+        if (!addresses) {
+          handle->fail(addresses.takeError());
+          return;
+        }
+        void *function =
+            addresses->begin()->second.getAddress().toPtr<void *>();
+        {
+          // ORC completes lookups with no context lock held.
+          std::lock_guard lock(compile_mutex);
+          // Unless the expression's arena has been released meanwhile.
+          auto found = function_names.find(canonical);
+          if (found != function_names.end() && found->second == name) {
+            canonical->pointer.store(function, std::memory_order_release);
+            compile_finished.notify_all();
+          }
+        }
+        handle->finish(function);
+      },
+      llvm::orc::NoDependenciesToRegister);
+  return handle;
+}
+
+extern "C" void *poll_compile_handle(CompileHandle *handle) {
+  return handle->function.load(std::memory_order_acquire);
+}
+
+extern "C" void *wait_compile_handle(CompileHandle *handle) {
+  std::unique_lock lock(handle->mutex);
+  handle->finished.wait(lock, [handle] { return handle->is_finished.load(); });
+  return handle->function;
+}
+
+extern "C" const char *get_compile_handle_error(CompileHandle *handle) {
+  if (!handle->is_finished.load(std::memory_order_acquire) ||
+      handle->function.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return handle->error.c_str();
+}
+
+extern "C" void delete_compile_handle(CompileHandle *handle) {
+  wait_compile_handle(handle);
+  delete handle;
+}
+
+static void get_function_profile(const FunctionProfile &profile,
+                                 FunctionProfileStats *stats) {
+  stats->name = profile.name.c_str();
+  stats->entry_count = profile.entry_count;
+  stats->cycles = profile.cycles;
+  stats->num_call_sites = profile.call_sites.size();
+}
+
+extern "C" std::size_t get_function_profiles(FunctionProfileStats *profiles,
+                                             std::size_t capacity) {
+  std::lock_guard lock(profiles_mutex);
+  std::size_t index = 0;
+  for (auto &[name, profile] : function_profiles) {
+    if (index == capacity) {
+      break;
+    }
+    get_function_profile(*profile, &profiles[index++]);
+  }
+  return function_profiles.size();
+}
+
+extern "C" bool get_expression_profile(Expression *expression,
+                                       FunctionProfileStats *stats) {
+  std::string name;
+  {
+    std::lock_guard lock(compile_mutex);
+    auto canonical =
+        canonical_expressions.find({expression, expression->signature});
+    if (canonical == canonical_expressions.end()) {
+      return false;
+    }
+    auto found = function_names.find(canonical->first);
+    if (found == function_names.end()) {
+      return false;
+    }
+    name = found->second;
+  }
+  std::lock_guard lock(profiles_mutex);
+  auto profile = function_profiles.find(name);
+  if (profile == function_profiles.end()) {
+    return false;
+  }
+  get_function_profile(*profile->second, stats);
+  return true;
+}
+
+extern "C" std::size_t get_call_site_profiles(const char *function_name,
+                                              CallSiteStats *call_sites,
+                                              std::size_t capacity) {
+  std::lock_guard lock(profiles_mutex);
+  auto profile = function_profiles.find(function_name);
+  if (profile == function_profiles.end()) {
+    return 0;
+  }
+  auto &profile_call_sites = profile->second->call_sites;
+  for (std::size_t index = 0;
+       index < std::min(capacity, profile_call_sites.size()); index++) {
+    CallSiteProfile &call_site = *profile_call_sites[index];
+    call_sites[index].callee = call_site.callee.c_str();
+    call_sites[index].count = call_site.count;
+    call_sites[index].target = reinterpret_cast<const void *>(
+        call_site.target.load());
+    call_sites[index].target_count = call_site.target_count;
+  }
+  return profile_call_sites.size();
+}
+
+extern "C" void reset_execution_profiles() {
+  std::lock_guard lock(profiles_mutex);
+  for (auto &[name, profile] : function_profiles) {
+    profile->entry_count = 0;
+    profile->cycles = 0;
+    for (auto &call_site : profile->call_sites) {
+      call_site->count = 0;
+      call_site->target_count = 0;
+      call_site->compile_count = 0;
+    }
+  }
+}
+
+// Only looks the expression up, so that asking about an expression that was
+// never compiled names nothing.
+extern "C" int get_expression_tier(Expression *expression) {
+  std::lock_guard lock(compile_mutex);
+  auto canonical =
+      canonical_expressions.find({expression, expression->signature});
+  if (canonical == canonical_expressions.end()) {
+    return 0;
+  }
+  auto name = function_names.find(canonical->first);
+  return name == function_names.end() ? 0 : get_tier(name->second);
+}
+
+extern "C" int get_function_tier(const char *function_name) {
+  std::lock_guard lock(compile_mutex);
+  return get_tier(function_name);
 }
 
 Context::Context()
@@ -575,20 +5089,206 @@ extern "C" void set_insert_point(Context *context, std::size_t block_index) {
   context->builder.SetInsertPoint(context->basic_blocks[block_index]);
 }
 
+static std::string get_insert_function_name(Context *context) {
+  return context->builder.GetInsertBlock()->getParent()->getName().str();
+}
+
 extern "C" void add_expression(Context *context, Expression *expression) {
-  expression->codegen(context->builder);
+  PhaseTimer timer(CompilePhase::IrBuild, get_insert_function_name(context));
+  codegen_simplified(context->builder, expression);
 }
 
 extern "C" void add_return(Context *context, Expression *expression) {
-  llvm::Value *value = expression->codegen(context->builder);
+  PhaseTimer timer(CompilePhase::IrBuild, get_insert_function_name(context));
+  llvm::Value *value = codegen_simplified(context->builder, expression);
   context->builder.CreateRet(value);
 }
 
-extern "C" void *compile(Context *context, const char *function_name) {
+// Splits `module` into up to `num_partitions` modules, each on a context of
+// its own so that compile threads can generate code for them concurrently, and
+// hands them to the JIT. Callers hold compile_mutex. Local symbols are kept in
+// the partition that uses them rather than exported, as every Context module
+// has its own private globals of the same names.
+static void
+add_partitioned_module(std::unique_ptr<llvm::Module> module,
+                       unsigned num_partitions,
+                       const llvm::orc::ResourceTrackerSP &resource_tracker) {
+  // Before splitting, so that the partitions hold each arena once between them.
+  take_arena_references(*module, resource_tracker);
+  llvm::SplitModule(
+      *module, num_partitions,
+      [&resource_tracker](std::unique_ptr<llvm::Module> partition) {
+        llvm::SmallVector<char, 0> bitcode;
+        llvm::raw_svector_ostream os(bitcode);
+        llvm::WriteBitcodeToFile(*partition, os);
+        auto context = std::make_unique<llvm::LLVMContext>();
+        auto parsed = exit_on_error(llvm::parseBitcodeFile(
+            llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(),
+                                                  bitcode.size()),
+                                  "partition"),
+            *context));
+        add_module(
+            llvm::orc::ThreadSafeModule(std::move(parsed), std::move(context)),
+            resource_tracker);
+      },
+      /*PreserveLocals=*/true);
+}
+
+// Hands the module of `context` to the JIT and returns the symbols compile()
+// looks up. With several compile threads, an eagerly compiled module is
+// partitioned, and all of its functions are looked up at once so that the
+// partitions are materialized in parallel.
+static llvm::orc::SymbolLookupSet
+add_context_module(Context *context, const char *function_name) {
   // context->module->print(llvm::outs(), nullptr);
-  exit_on_error(jit->addIRModule(llvm::orc::ThreadSafeModule(
-      std::move(context->module), std::move(context->llvm_context))));
-  return exit_on_error(jit->lookup(function_name)).toPtr<void *>();
+  std::vector<std::string> names{function_name};
+  {
+    std::lock_guard lock(compile_mutex);
+    context->resource_tracker = jit->getMainJITDylib().createResourceTracker();
+    if (jit_options.lazy_compilation || jit_options.num_compile_threads < 2) {
+      add_module(
+          llvm::orc::ThreadSafeModule(std::move(context->module),
+                                      std::move(context->llvm_context)),
+          context->resource_tracker, jit_options.lazy_compilation);
+    } else {
+      for (llvm::Function &function : *context->module) {
+        if (!function.isDeclaration() && function.hasExternalLinkage() &&
+            function.getName() != function_name) {
+          names.push_back(function.getName().str());
+        }
+      }
+      add_partitioned_module(std::move(context->module),
+                             jit_options.num_compile_threads,
+                             context->resource_tracker);
+    }
+  }
+  llvm::orc::SymbolLookupSet symbols;
+  for (const std::string &name : names) {
+    symbols.add(jit->mangleAndIntern(name));
+  }
+  return symbols;
+}
+
+extern "C" void *compile(Context *context, const char *function_name) {
+  auto symbols = add_context_module(context, function_name);
+  PhaseTimer timer(CompilePhase::Lookup, function_name);
+  auto addresses = exit_on_error(jit->getExecutionSession().lookup(
+      llvm::orc::makeJITDylibSearchOrder(
+          &jit->getMainJITDylib(),
+          llvm::orc::JITDylibLookupFlags::MatchAllSymbols),
+      std::move(symbols)));
+  auto &symbol = addresses[jit->mangleAndIntern(function_name)];
+  return symbol.getAddress().toPtr<void *>();
+}
+
+extern "C" void *lookup_function(const char *function_name) {
+  PhaseTimer timer(CompilePhase::Lookup, function_name);
+  auto symbol = jit->lookup(function_name);
+  if (!symbol) {
+    llvm::consumeError(symbol.takeError());
+    return nullptr;
+  }
+  return symbol->toPtr<void *>();
+}
+
+extern "C" CompileHandle *compile_async(Context *context,
+                                        const char *function_name,
+                                        CompileCallback callback,
+                                        void *user_data) {
+  auto handle = new CompileHandle(callback, user_data);
+  auto symbol = jit->mangleAndIntern(function_name);
+  jit->getExecutionSession().lookup(
+      llvm::orc::LookupKind::Static,
+      llvm::orc::makeJITDylibSearchOrder(
+          &jit->getMainJITDylib(),
+          llvm::orc::JITDylibLookupFlags::MatchAllSymbols),
+      add_context_module(context, function_name),
+      llvm::orc::SymbolState::Ready,
+      [handle, symbol](llvm::Expected<llvm::orc::SymbolMap> addresses) {
+        if (!addresses) {
+          handle->fail(addresses.takeError());
+          return;
+        }
+        handle->finish((*addresses)[symbol].getAddress().toPtr<void *>());
+      },
+      llvm::orc::NoDependenciesToRegister);
+  return handle;
+}
+
+extern "C" bool release_context(Context *context) {
+  if (jit_options.lazy_compilation) {
+    return false;
+  }
+  std::unique_lock lock(compile_mutex);
+  if (context->resource_tracker) {
+    llvm::orc::ResourceTrackerSP resource_tracker =
+        std::move(context->resource_tracker);
+    context->resource_tracker = nullptr;
+    remove_code(resource_tracker, lock);
+  }
+  return true;
 }
 
 extern "C" void delete_context(Context *context) { delete context; }
+
+extern "C" void get_jit_memory_stats(JitMemoryStats *stats) {
+  stats->code_bytes = num_code_bytes;
+  stats->data_bytes = num_data_bytes;
+  stats->num_objects = num_loaded_objects;
+}
+
+extern "C" void get_jit_stats(JitStats *stats) {
+  auto get_time = [](CompilePhase phase) -> std::uint64_t {
+    return compile_phase_times[static_cast<std::size_t>(phase)];
+  };
+  stats->ir_build_time = get_time(CompilePhase::IrBuild);
+  stats->optimization_time = get_time(CompilePhase::Optimization);
+  stats->code_generation_time = get_time(CompilePhase::CodeGeneration);
+  stats->linking_time = get_time(CompilePhase::Linking);
+  stats->lookup_time = get_time(CompilePhase::Lookup);
+  stats->num_modules = num_optimized_modules;
+  stats->num_functions = num_materialized_functions;
+  stats->num_instructions = num_optimized_instructions;
+  stats->code_bytes = num_emitted_code_bytes;
+}
+
+extern "C" void start_jit_trace() {
+  std::lock_guard lock(trace_mutex);
+  trace_events.clear();
+  trace_start = std::chrono::steady_clock::now();
+  is_tracing = true;
+}
+
+extern "C" void write_jit_trace(const char *path) {
+  std::lock_guard lock(trace_mutex);
+  is_tracing = false;
+  std::error_code error;
+  llvm::raw_fd_ostream stream(path, error);
+  exit_on_error(llvm::errorCodeToError(error));
+  auto to_microseconds = [](std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+  };
+  llvm::json::OStream json(stream);
+  json.object([&] {
+    json.attributeArray("traceEvents", [&] {
+      for (const TraceEvent &event : trace_events) {
+        json.object([&] {
+          json.attribute("name",
+                         compile_phase_names[static_cast<std::size_t>(
+                             event.phase)]);
+          json.attribute("cat", "jit");
+          json.attribute("ph", "X");
+          json.attribute("ts", to_microseconds(event.start - trace_start));
+          json.attribute("dur", to_microseconds(event.duration));
+          json.attribute("pid", llvm::sys::Process::getProcessId());
+          json.attribute("tid", static_cast<std::int64_t>(event.thread));
+          if (!event.detail.empty()) {
+            json.attributeObject(
+                "args", [&] { json.attribute("detail", event.detail); });
+          }
+        });
+      }
+    });
+  });
+  trace_events.clear();
+}
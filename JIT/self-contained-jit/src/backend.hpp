@@ -1,18 +1,41 @@
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Value.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/Error.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class ExpressionEncoder;
 
 class Type {
 public:
   virtual ~Type();
   virtual llvm::Type *into_llvm_type(llvm::LLVMContext &) const = 0;
+  virtual void encode(ExpressionEncoder &) const = 0;
 };
 
 class BooleanType : public Type {
 public:
   llvm::Type *into_llvm_type(llvm::LLVMContext &) const override;
+  void encode(ExpressionEncoder &) const override;
 };
 
 extern "C" BooleanType *get_boolean_type();
@@ -20,6 +43,7 @@ extern "C" BooleanType *get_boolean_type();
 class IntegerType : public Type {
 public:
   llvm::Type *into_llvm_type(llvm::LLVMContext &) const override;
+  void encode(ExpressionEncoder &) const override;
 };
 
 extern "C" IntegerType *get_integer_type();
@@ -27,6 +51,7 @@ extern "C" IntegerType *get_integer_type();
 class SizeType : public Type {
 public:
   llvm::Type *into_llvm_type(llvm::LLVMContext &) const override;
+  void encode(ExpressionEncoder &) const override;
 };
 
 extern "C" SizeType *get_size_type();
@@ -34,42 +59,258 @@ extern "C" SizeType *get_size_type();
 class StringType : public Type {
 public:
   llvm::Type *into_llvm_type(llvm::LLVMContext &) const override;
+  void encode(ExpressionEncoder &) const override;
 };
 
 extern "C" StringType *get_string_type();
 
+class FloatType : public Type {
+public:
+  llvm::Type *into_llvm_type(llvm::LLVMContext &) const override;
+  void encode(ExpressionEncoder &) const override;
+};
+
+extern "C" FloatType *get_float_type();
+
+class DoubleType : public Type {
+public:
+  llvm::Type *into_llvm_type(llvm::LLVMContext &) const override;
+  void encode(ExpressionEncoder &) const override;
+};
+
+extern "C" DoubleType *get_double_type();
+
+// Fixed-width vector of a boolean, integer, size or floating-point type.
+class VectorType : public Type {
+public:
+  Type *element_type;
+  std::size_t num_elements;
+  VectorType(Type *, std::size_t);
+  llvm::Type *into_llvm_type(llvm::LLVMContext &) const override;
+  void encode(ExpressionEncoder &) const override;
+};
+
+// Vector types are unique per element type and width, so they can be compared
+// by address like the other types.
+extern "C" VectorType *get_vector_type(Type *, std::size_t);
+
 struct TypeContext {
   BooleanType boolean_type;
   IntegerType integer_type;
   SizeType size_type;
   StringType string_type;
+  FloatType float_type;
+  DoubleType double_type;
+  std::mutex vector_types_mutex;
+  std::map<std::pair<Type *, std::size_t>, std::unique_ptr<VectorType>>
+      vector_types;
+};
+
+enum class ExpressionKind {
+  Parameter,
+  Boolean,
+  Integer,
+  AddInteger,
+  Float,
+  Double,
+  FloatOperation,
+  Vector,
+  ExtractElement,
+  Size,
+  String,
+  Print,
+  Array,
+  Function,
+  ReadyMade,
+  Call,
+  Bytecode,
+};
+
+class ExpressionArena;
+struct Simplifier;
+struct Interpreter;
+
+// The return type of compiled code followed by its parameter types.
+using Signature = std::vector<Type *>;
+
+// A value of any non-vector type, as the interpreter passes it around.
+union RuntimeValue {
+  bool boolean;
+  int integer;
+  std::size_t size;
+  float float_value;
+  double double_value;
+  struct {
+    std::size_t length;
+    const char *pointer;
+  } string;
 };
 
 class Expression {
 public:
-  void *pointer;
+  // Compiled code of the expression, or null until it has been compiled.
+  std::atomic<void *> pointer;
+  // What `pointer` is compiled for. Set once, before `pointer` is first set;
+  // code of other signatures is kept elsewhere.
+  const Signature *signature;
+  // Structural hash, computed by each constructor from the node's fields and
+  // the hashes of its children.
+  std::size_t hash;
+  // Arena the expression was created in, or null for ready-made functions and
+  // the keys of lookups.
+  ExpressionArena *arena;
   Expression();
+  // Copies the structure only; the copy is not compiled yet.
+  Expression(const Expression &);
   virtual ~Expression();
   virtual llvm::Value *codegen(llvm::IRBuilderBase &) const = 0;
   virtual void debug_print(std::ostream &) const = 0;
-  virtual Expression *to_constructor() const = 0;
+  virtual Expression *to_constructor(ExpressionArena &) const = 0;
+  // Writes the node after its children; see ExpressionEncoder.
+  virtual void encode(ExpressionEncoder &) const = 0;
+  // Returns an equivalent expression with constants folded and calls with
+  // constant arguments inlined, or the node itself if nothing changes.
+  virtual Expression *simplify(Simplifier &) = 0;
+  // Whether the interpreter can run the expression.
+  virtual bool can_evaluate() const = 0;
+  // Runs the expression in the interpreter; see evaluate_expression.
+  virtual RuntimeValue evaluate(Interpreter &) const = 0;
+  virtual ExpressionKind kind() const = 0;
+  // Structural equality with an expression of the same kind.
+  virtual bool equals(const Expression *) const = 0;
+};
+
+struct ExpressionHash {
+  std::size_t operator()(const Expression *) const;
+};
+
+struct ExpressionEqual {
+  bool operator()(const Expression *, const Expression *) const;
+};
+
+// Owns expressions and the arrays they refer to, released all at once.
+// Thread-safe.
+class ExpressionArena {
+  std::mutex mutex;
+  llvm::BumpPtrAllocator allocator;
+  std::vector<Expression *> expressions;
+  // Whether the addresses of the expressions are indexed, so that an
+  // expression can be told by its address, as those of arenas from
+  // create_expression_arena are.
+  bool is_indexed;
+  std::unordered_set<Expression *, ExpressionHash, ExpressionEqual> interned;
+
+  void *allocate(std::size_t, std::size_t);
+  void add(Expression *);
+
+public:
+  // Every expression created in the arena.
+  llvm::ArrayRef<Expression *> get_expressions() const { return expressions; }
+  // Number of expressions created in the arena.
+  std::size_t size();
+  explicit ExpressionArena(bool is_indexed = false) : is_indexed(is_indexed) {}
+  ExpressionArena(const ExpressionArena &) = delete;
+  ExpressionArena &operator=(const ExpressionArena &) = delete;
+
+  template <typename T, typename... Arguments>
+  T *create(Arguments &&...arguments) {
+    T *expression = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Arguments>(arguments)...);
+    add(expression);
+    return expression;
+  }
+
+  template <typename T> llvm::ArrayRef<T> copy(llvm::ArrayRef<T> elements) {
+    T *copied =
+        static_cast<T *>(allocate(sizeof(T) * elements.size(), alignof(T)));
+    std::uninitialized_copy(elements.begin(), elements.end(), copied);
+    return llvm::ArrayRef<T>(copied, elements.size());
+  }
+
+  // Returns the expression structurally equal to `key`, or the one `create`
+  // makes.
+  Expression *intern(const Expression &key,
+                     llvm::function_ref<Expression *()> create);
 };
 
+// The children of an expression must come from its own arena or from one
+// that outlives it.
+extern "C" ExpressionArena *create_expression_arena();
+
+// Code compiled from the arena's expressions stays valid. Constructor code
+// refers to the arena itself, which is only freed along with the last such
+// code; the arena must live until that code has been handed to the JIT.
+extern "C" void delete_expression_arena(ExpressionArena *);
+
+// The simplified expression is allocated in the given arena, and may share
+// nodes with the callees it has inlined, whose arenas must outlive it.
+extern "C" Expression *simplify_expression(ExpressionArena *, Expression *);
+
+// Hits and misses of hash-consing and of the compiled-code cache.
+struct ExpressionCacheStats {
+  std::size_t intern_hits;
+  std::size_t intern_misses;
+  std::size_t code_hits;
+  std::size_t code_misses;
+};
+
+extern "C" void get_expression_cache_stats(ExpressionCacheStats *);
+
+// Number of expressions and expression arrays allocated so far.
+extern "C" std::size_t get_expression_allocation_count();
+
 extern "C" void debug_print(Expression *);
 
-extern "C" Expression *to_constructor(Expression *);
+// Postorder encoding of an expression with back-references for shared nodes.
+// Strings are encoded with their characters, which decoding copies.
+class ExpressionEncoder {
+  std::unordered_map<const Expression *, std::size_t> indices;
+
+public:
+  std::string bytes;
+  void write_byte(unsigned char);
+  void write_unsigned(std::uint64_t);
+  void write_signed(std::int64_t);
+  void write_string(llvm::StringRef);
+  void write_kind(ExpressionKind);
+  void write_type(const Type *);
+  void write_expression(const Expression *);
+};
+
+// Writes the encoding of the expression to `buffer` if it fits in `capacity`
+// bytes, and returns its size either way.
+extern "C" std::size_t encode_expression(Expression *, char *, std::size_t);
+
+// Rebuilds an encoded expression in the arena. Returns null if the encoding is
+// truncated or malformed.
+extern "C" Expression *decode_expression(ExpressionArena *, const char *,
+                                         std::size_t);
+
+// The constructor expression decodes an embedded encoding into the arena.
+extern "C" Expression *to_constructor(ExpressionArena *, Expression *);
+
+// Same as to_constructor, but as a tree of calls to the create_* functions,
+// one per node.
+extern "C" Expression *to_constructor_tree(ExpressionArena *, Expression *);
 
 class Parameter : public Expression {
   int index;
 
 public:
   Parameter(int);
+  int get_index() const { return index; }
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Parameter *create_parameter(int);
+extern "C" Parameter *create_parameter(ExpressionArena *, int);
 
 class Boolean : public Expression {
   bool value;
@@ -78,46 +319,190 @@ public:
   Boolean(bool);
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Boolean *create_boolean(bool);
+extern "C" Boolean *create_boolean(ExpressionArena *, bool);
 
 class Integer : public Expression {
   int value;
 
 public:
   Integer(int);
+  int get_value() const { return value; }
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Integer *create_integer(int);
+extern "C" Integer *create_integer(ExpressionArena *, int);
 
 class AddInteger : public Expression {
   Expression *left, *right;
 
 public:
   AddInteger(Expression *, Expression *);
+  Expression *get_left() const { return left; }
+  llvm::Value *codegen(llvm::IRBuilderBase &) const override;
+  void debug_print(std::ostream &) const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
+};
+
+extern "C" AddInteger *create_add_integer(ExpressionArena *, Expression *,
+                                          Expression *);
+
+class Float : public Expression {
+  float value;
+
+public:
+  Float(float);
+  float get_value() const { return value; }
+  llvm::Value *codegen(llvm::IRBuilderBase &) const override;
+  void debug_print(std::ostream &) const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
+};
+
+extern "C" Float *create_float(ExpressionArena *, float);
+
+class Double : public Expression {
+  double value;
+
+public:
+  Double(double);
+  double get_value() const { return value; }
+  llvm::Value *codegen(llvm::IRBuilderBase &) const override;
+  void debug_print(std::ostream &) const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
+};
+
+extern "C" Double *create_double(ExpressionArena *, double);
+
+enum class FloatOperator {
+  Add,
+  Subtract,
+  Multiply,
+  Divide,
+};
+
+// Float arithmetic, element-wise on vectors. `is_fast` sets fast-math flags.
+class FloatOperation : public Expression {
+  FloatOperator op;
+  Expression *left, *right;
+  bool is_fast;
+
+public:
+  FloatOperation(FloatOperator, Expression *, Expression *, bool);
+  llvm::Value *codegen(llvm::IRBuilderBase &) const override;
+  void debug_print(std::ostream &) const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
+};
+
+extern "C" FloatOperation *create_add_float(ExpressionArena *, Expression *,
+                                            Expression *, bool);
+extern "C" FloatOperation *
+create_subtract_float(ExpressionArena *, Expression *, Expression *, bool);
+extern "C" FloatOperation *
+create_multiply_float(ExpressionArena *, Expression *, Expression *, bool);
+extern "C" FloatOperation *create_divide_float(ExpressionArena *, Expression *,
+                                               Expression *, bool);
+
+// Vector value built from one expression per element. AddInteger and the
+// float operations apply to vectors element-wise.
+class Vector : public Expression {
+  VectorType *type;
+  llvm::ArrayRef<Expression *> elements;
+
+public:
+  Vector(VectorType *, llvm::ArrayRef<Expression *>);
+  llvm::ArrayRef<Expression *> get_elements() const { return elements; }
+  llvm::Value *codegen(llvm::IRBuilderBase &) const override;
+  void debug_print(std::ostream &) const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
+};
+
+// `elements` holds `type->num_elements` expressions.
+extern "C" Vector *create_vector(ExpressionArena *, VectorType *,
+                                 Expression **);
+
+class ExtractElement : public Expression {
+  Expression *vector, *index;
+
+public:
+  ExtractElement(Expression *, Expression *);
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" AddInteger *create_add_integer(Expression *, Expression *);
+extern "C" ExtractElement *create_extract_element(ExpressionArena *,
+                                                  Expression *, Expression *);
 
 class Size : public Expression {
   std::size_t value;
 
 public:
   Size(std::size_t);
+  std::size_t get_value() const { return value; }
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Size *create_size(std::size_t);
+extern "C" Size *create_size(ExpressionArena *, std::size_t);
 
 class String : public Expression {
   std::size_t length;
@@ -127,10 +512,17 @@ public:
   String(std::size_t, const char *);
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" String *create_string(std::size_t, const char *);
+extern "C" String *create_string(ExpressionArena *, std::size_t,
+                                 const char *);
 
 class Print : public Expression {
   Expression *string;
@@ -139,67 +531,374 @@ public:
   Print(Expression *);
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Print *create_print(Expression *);
+extern "C" Print *create_print(ExpressionArena *, Expression *);
 
+// Evaluates to the address of the elements, as a size. The elements must not
+// be written through it: an array of constants is shared by every execution.
 class Array : public Expression {
   Type *type;
-  std::vector<Expression *> elements;
+  llvm::ArrayRef<Expression *> elements;
 
 public:
-  Array(Type *, std::vector<Expression *>);
+  Array(Type *, llvm::ArrayRef<Expression *>);
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Array *create_array(Type *, std::size_t, Expression **);
+extern "C" Array *create_array(ExpressionArena *, Type *, std::size_t,
+                               Expression **);
 
 class Function : public Expression {
   const char *name;
   Type *return_type;
-  std::vector<Type *> parameters_type;
+  llvm::ArrayRef<Type *> parameters_type;
   bool is_variadic;
 
 public:
-  Function(const char *, Type *, std::vector<Type *>, bool);
+  Function(const char *, Type *, llvm::ArrayRef<Type *>, bool);
+  const char *get_name() const { return name; }
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Function *create_function(const char *, Type *, std::size_t, Type **,
-                                     bool);
+extern "C" Function *create_function(ExpressionArena *, const char *, Type *,
+                                     std::size_t, Type **, bool);
+
+// What a Function expression evaluates to. One per function name.
+class ReadyMade : public Expression {
+  std::string name;
+
+public:
+  ReadyMade(std::string);
+  llvm::Value *codegen(llvm::IRBuilderBase &) const override;
+  void debug_print(std::ostream &) const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
+  // Sets `pointer` to the function's address.
+  void resolve();
+};
 
 class Call : public Expression {
   Expression *function;
   Type *return_type;
-  std::vector<Type *> parameters_type;
+  llvm::ArrayRef<Type *> parameters_type;
   bool is_variadic;
-  std::vector<Expression *> arguments;
+  llvm::ArrayRef<Expression *> arguments;
+
+  llvm::Value *build_runtime_call(llvm::IRBuilderBase &, llvm::StringRef,
+                                  llvm::ArrayRef<llvm::Value *>,
+                                  llvm::Value *) const;
+  llvm::Value *build_compile_expression_call(llvm::IRBuilderBase &,
+                                             llvm::Value *) const;
+  llvm::Value *build_resolve_call_site_call(llvm::IRBuilderBase &,
+                                            llvm::Value *,
+                                            llvm::Value *) const;
+  llvm::Value *build_call_site_lookup(llvm::IRBuilderBase &,
+                                      llvm::FunctionType *,
+                                      llvm::Value *) const;
 
 public:
-  Call(Expression *, Type *, const std::vector<Type *> &, bool,
-       const std::vector<Expression *> &);
+  Call(Expression *, Type *, llvm::ArrayRef<Type *>, bool,
+       llvm::ArrayRef<Expression *>);
+  Type *get_return_type() const { return return_type; }
   llvm::Value *codegen(llvm::IRBuilderBase &) const override;
   void debug_print(std::ostream &) const override;
-  Expression *to_constructor() const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
 };
 
-extern "C" Call *create_call(Expression *, Type *, std::size_t, Type **, bool,
-                             Expression **);
+extern "C" Call *create_call(ExpressionArena *, Expression *, Type *,
+                             std::size_t, Type **, bool, Expression **);
+
+// Constant bytes, evaluating to their address as a size. The generated code
+// keeps its own copy.
+class Bytecode : public Expression {
+  llvm::ArrayRef<char> data;
+
+public:
+  Bytecode(llvm::ArrayRef<char>);
+  llvm::Value *codegen(llvm::IRBuilderBase &) const override;
+  void debug_print(std::ostream &) const override;
+  Expression *to_constructor(ExpressionArena &) const override;
+  void encode(ExpressionEncoder &) const override;
+  Expression *simplify(Simplifier &) override;
+  bool can_evaluate() const override;
+  RuntimeValue evaluate(Interpreter &) const override;
+  ExpressionKind kind() const override;
+  bool equals(const Expression *) const override;
+};
+
+extern "C" Bytecode *create_bytecode(ExpressionArena *, std::size_t,
+                                     const char *);
+
+struct JitOptions {
+  // 0 to 3, for both the IR pipeline and code generation.
+  unsigned opt_level;
+  // Generate code for the host CPU instead of a generic one.
+  bool tune_for_host;
+  // Calls after which a function is recompiled at -O3. Zero disables tiering.
+  std::size_t tier_up_threshold;
+  // Directory of the persistent object cache, or null.
+  const char *cache_directory;
+  // Background compile threads, of which there is always at least one for
+  // asynchronous compiles and tier-ups; compile() partitions modules over two
+  // or more.
+  unsigned num_compile_threads;
+  // Compile Context functions on their first call.
+  bool lazy_compilation;
+  // Evaluations interpreted before an expression is compiled.
+  std::size_t interpreter_threshold;
+  // Resolve unregistered symbols by searching the process.
+  bool search_process_symbols;
+  // Register compiled code with GDB and perf.
+  bool profiler_support;
+  // Count function entries and calls at Call sites.
+  bool profile_execution;
+  // With profile_execution, also sum the cycles spent in each function.
+  bool profile_cycles;
+  // With tier_up_threshold and profile_execution, optimize the second tier
+  // with the profile of the first.
+  bool profile_guided_recompilation;
+
+  // The options initialize_jit uses.
+  JitOptions();
+};
+
+// Fills `options` with the options initialize_jit uses.
+extern "C" void get_default_jit_options(JitOptions *);
 
 extern "C" void initialize_jit();
 
+extern "C" void initialize_jit_with_options(const JitOptions *);
+
+// Resolves `name` to `address` in compiled code. Register after initializing
+// the JIT and before use. Returns false if the JIT is not initialized yet or
+// `name` is defined already, as the runtime's own symbols are.
+extern "C" bool register_symbol(const char *, void *);
+
+// Number of functions materialized so far.
+extern "C" std::size_t get_materialized_function_count();
+
+// Staged expressions share one module, flushed on demand, after `batch_limit`
+// expressions or after `batch_delay`.
+struct CompileQueue {
+  llvm::orc::ThreadSafeContext context;
+  std::unique_ptr<llvm::Module> module;
+  std::unordered_set<Expression *> pending;
+  std::unordered_set<Expression *> submitted;
+  // Expressions whose code a thread is currently looking up.
+  std::unordered_set<Expression *> resolving;
+  std::size_t batch_limit;
+  // Zero if batches wait for as long as it takes.
+  std::chrono::steady_clock::duration batch_delay;
+  std::chrono::steady_clock::time_point oldest_pending_time;
+  // The runtime helpers parsed into `context` once, which link_runtime_helpers
+  // clones for each module on it. Declared after `context`, so that it goes
+  // first. Guarded by the context's lock.
+  std::unique_ptr<llvm::Module> runtime_helpers;
+
+public:
+  CompileQueue();
+};
+
+extern "C" void set_compile_batch_limit(std::size_t);
+
+// A background thread flushes a batch once its oldest expression has waited
+// for `microseconds`.
+extern "C" void set_compile_batch_delay(std::size_t microseconds);
+
+extern "C" void stage_expression(Expression *, Type *, std::size_t, Type **);
+
+extern "C" void flush_compile_queue();
+
 extern "C" void *compile_expression(Expression *, Type *, std::size_t, Type **);
 
+// Appends `name` to the expression's symbol unless it is already named.
+extern "C" void set_expression_name(Expression *, const char *);
+
+// Compiles a function that evaluates the expression over whole columns:
+//   void (std::size_t count, const void *const *columns, void *results)
+extern "C" void *compile_expression_batch(Expression *, Type *, std::size_t,
+                                          Type **);
+
+// Frees the expression's code for every signature. Code that calls it must be
+// released first or no longer run.
+extern "C" void release_expression(Expression *);
+
+// Interprets the expression while it is cold, and compiles it once it is hot.
+extern "C" void evaluate_expression(Expression *, Type *, std::size_t, Type **,
+                                    const RuntimeValue *, RuntimeValue *);
+
+// Called with the user data and the compiled function, or null if the
+// compilation failed.
+using CompileCallback = void (*)(void *, void *);
+
+// The pending result of compile_async or compile_expression_async.
+struct CompileHandle {
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::atomic<void *> function;
+  // Set along with `function`, which stays null if `error` is set.
+  std::atomic<bool> is_finished;
+  std::string error;
+  CompileCallback callback;
+  void *user_data;
+
+public:
+  CompileHandle(CompileCallback, void *);
+  void finish(void *);
+  void fail(llvm::Error);
+};
+
+// Like compile_expression, but returns without waiting for the code.
+extern "C" CompileHandle *compile_expression_async(Expression *, Type *,
+                                                   std::size_t, Type **,
+                                                   CompileCallback, void *);
+
+// The compiled function, or null while it is not ready yet or if the
+// compilation failed.
+extern "C" void *poll_compile_handle(CompileHandle *);
+
+// Blocks until the compilation has finished and returns the compiled function,
+// or null if it failed.
+extern "C" void *wait_compile_handle(CompileHandle *);
+
+// Why the compilation failed, or null if it has not finished or succeeded.
+extern "C" const char *get_compile_handle_error(CompileHandle *);
+
+// Waits for the compilation if it is still running.
+extern "C" void delete_compile_handle(CompileHandle *);
+
+// Tiering state of a function `f`, which jumps through `f.implementation`.
+struct TierState : std::enable_shared_from_this<TierState> {
+  std::atomic<std::size_t> call_count;
+  std::atomic<int> tier;
+  std::string name;
+  // The module `f` came from as it was before tiering, to recompile from.
+  std::shared_ptr<llvm::orc::ThreadSafeModule> source;
+  // Where `f` was added, and where its optimized code is added too.
+  llvm::orc::ResourceTrackerSP resource_tracker;
+  // Set once the tier-up has patched `f.implementation` or failed.
+  std::mutex mutex;
+  std::condition_variable tier_up_finished;
+  bool is_tier_up_finished;
+
+public:
+  TierState(std::string, std::shared_ptr<llvm::orc::ThreadSafeModule>,
+            llvm::orc::ResourceTrackerSP);
+  void finish_tier_up();
+  // Blocks until the tier-up has finished, if `f` has become hot.
+  void wait_for_tier_up();
+};
+
+// Called by first-tier code when its function has become hot. Returns at once;
+// the optimized tier is compiled on a compile thread.
+extern "C" void tier_up(TierState *, void **);
+
+// The last callee of a call site with a run-time callee, and its code.
+struct CallSiteEntry {
+  std::atomic<std::size_t> key;
+  void *target;
+};
+
+// Called by a call site whose entry is not for its callee.
+extern "C" void *resolve_call_site(std::atomic<CallSiteEntry *> *,
+                                   Expression *, Type *, std::size_t, Type **);
+
+// Counters that profiled code updates in place.
+struct CallSiteProfile {
+  std::atomic<std::uint64_t> count;
+  // Empty if the callee is only known at run time.
+  std::string callee;
+  // The last target of a run-time callee, and calls that repeated it.
+  std::atomic<std::uintptr_t> target;
+  std::atomic<std::uint64_t> target_count;
+  // Calls through a run-time callee that missed the call site's cache.
+  std::atomic<std::uint64_t> compile_count;
+};
+
+struct FunctionProfile {
+  std::atomic<std::uint64_t> entry_count;
+  std::atomic<std::uint64_t> cycles;
+  std::string name;
+  // In the order of the calls in the function's IR.
+  std::vector<std::unique_ptr<CallSiteProfile>> call_sites;
+  // The module a tiered function came from, for its callers to inline.
+  std::weak_ptr<llvm::orc::ThreadSafeModule> source;
+};
+
+// A snapshot of a FunctionProfile.
+struct FunctionProfileStats {
+  const char *name;
+  std::uint64_t entry_count;
+  std::uint64_t cycles;
+  std::size_t num_call_sites;
+};
+
+// `callee` stays valid until the function is compiled again.
+struct CallSiteStats {
+  const char *callee;
+  std::uint64_t count;
+  const void *target;
+  std::uint64_t target_count;
+};
+
+// Writes up to `capacity` profiles and returns how many there are.
+extern "C" std::size_t get_function_profiles(FunctionProfileStats *,
+                                             std::size_t);
+
+extern "C" bool get_expression_profile(Expression *, FunctionProfileStats *);
+
+// Writes up to `capacity` call sites and returns how many there are.
+extern "C" std::size_t get_call_site_profiles(const char *, CallSiteStats *,
+                                              std::size_t);
+
+extern "C" void reset_execution_profiles();
+
+extern "C" int get_expression_tier(Expression *);
+
+extern "C" int get_function_tier(const char *);
+
 struct Context {
   std::unique_ptr<llvm::LLVMContext> llvm_context;
   llvm::IRBuilder<llvm::ConstantFolder, llvm::IRBuilderDefaultInserter> builder;
   std::unique_ptr<llvm::Module> module;
   std::vector<llvm::BasicBlock *> basic_blocks;
+  // Everything compile() added to the JIT for the context.
+  llvm::orc::ResourceTrackerSP resource_tracker;
 
 public:
   Context();
@@ -218,4 +917,47 @@ extern "C" void add_return(Context *, Expression *);
 
 extern "C" void *compile(Context *, const char *);
 
+// Returns a function an earlier compile() has added, compiling it first if it
+// has not been yet, or null if no function of that name has been added.
+extern "C" void *lookup_function(const char *);
+
+// Like compile, but returns without waiting for the code.
+extern "C" CompileHandle *compile_async(Context *, const char *,
+                                        CompileCallback, void *);
+
+// Frees the code compile() generated for the context, and tells whether it
+// could. With lazy_compilation, functions are compiled into a JITDylib of the
+// lazy layer's own that the context cannot free, so their code is kept.
+extern "C" bool release_context(Context *);
+
 extern "C" void delete_context(Context *);
+
+// Sizes of the objects the JIT currently holds.
+struct JitMemoryStats {
+  std::size_t code_bytes;
+  std::size_t data_bytes;
+  std::size_t num_objects;
+};
+
+extern "C" void get_jit_memory_stats(JitMemoryStats *);
+
+// Totals over every compilation so far. Times are in nanoseconds.
+struct JitStats {
+  std::uint64_t ir_build_time;
+  std::uint64_t optimization_time;
+  std::uint64_t code_generation_time;
+  std::uint64_t linking_time;
+  std::uint64_t lookup_time;
+  std::size_t num_modules;
+  std::size_t num_functions;
+  std::size_t num_instructions;
+  std::size_t code_bytes;
+};
+
+extern "C" void get_jit_stats(JitStats *);
+
+// Records compile phases from now on.
+extern "C" void start_jit_trace();
+
+// Writes the recorded phases to `path` as a Chrome trace.
+extern "C" void write_jit_trace(const char *);
@@ -6,21 +6,29 @@ unsafe extern "C" {
     fn get_integer_type() -> *const c_void;
     fn get_size_type() -> *const c_void;
     fn get_string_type() -> *const c_void;
+    fn create_expression_arena() -> *const c_void;
+    fn delete_expression_arena(arena: *const c_void);
     fn debug_print(expression: *const c_void);
-    fn to_constructor(expression: *const c_void) -> *const c_void;
-    fn create_parameter(index: i32) -> *const c_void;
-    fn create_boolean(value: bool) -> *const c_void;
-    fn create_integer(value: i32) -> *const c_void;
-    fn create_add_integer(left: *const c_void, right: *const c_void) -> *const c_void;
-    fn create_size(value: usize) -> *const c_void;
-    fn create_string(length: usize, pointer: *const u8) -> *const c_void;
-    fn create_print(expression: *const c_void) -> *const c_void;
+    fn to_constructor(arena: *const c_void, expression: *const c_void) -> *const c_void;
+    fn create_parameter(arena: *const c_void, index: i32) -> *const c_void;
+    fn create_boolean(arena: *const c_void, value: bool) -> *const c_void;
+    fn create_integer(arena: *const c_void, value: i32) -> *const c_void;
+    fn create_add_integer(
+        arena: *const c_void,
+        left: *const c_void,
+        right: *const c_void,
+    ) -> *const c_void;
+    fn create_size(arena: *const c_void, value: usize) -> *const c_void;
+    fn create_string(arena: *const c_void, length: usize, pointer: *const u8) -> *const c_void;
+    fn create_print(arena: *const c_void, expression: *const c_void) -> *const c_void;
     fn create_array(
+        arena: *const c_void,
         element_type: *const c_void,
         num_elements: usize,
         elements: *const *const c_void,
     ) -> *const c_void;
     fn create_function(
+        arena: *const c_void,
         name: *const c_char,
         return_type: *const c_void,
         num_parameters: usize,
@@ -28,6 +36,7 @@ unsafe extern "C" {
         is_variadic: bool,
     ) -> *const c_void;
     fn create_call(
+        arena: *const c_void,
         function: *const c_void,
         return_type: *const c_void,
         num_parameters: usize,
@@ -64,6 +73,7 @@ extern "C" fn add_100(x: c_int) -> c_int {
 
 fn main() {
     unsafe { initialize_jit() };
+    let arena = unsafe { create_expression_arena() };
     let result = unsafe {
         let context = create_context();
         add_function(
@@ -78,14 +88,16 @@ fn main() {
         add_return(
             context,
             create_add_integer(
-                create_parameter(0),
+                arena,
+                create_parameter(arena, 0),
                 create_call(
-                    to_constructor(create_parameter(0)),
+                    arena,
+                    to_constructor(arena, create_parameter(arena, 0)),
                     get_integer_type(),
                     1,
                     &[get_integer_type()] as *const _,
                     false,
-                    &[create_integer(1)] as *const _,
+                    &[create_integer(arena, 1)] as *const _,
                 ),
             ),
         );
@@ -101,7 +113,9 @@ fn main() {
         add_expression(
             context,
             create_call(
+                arena,
                 create_function(
+                    arena,
                     c"add_100".as_ptr(),
                     get_integer_type(),
                     1,
@@ -113,7 +127,9 @@ fn main() {
                 &[get_integer_type()] as *const _,
                 false,
                 &[create_call(
+                    arena,
                     create_function(
+                        arena,
                         c"0".as_ptr(),
                         get_integer_type(),
                         1,
@@ -124,14 +140,15 @@ fn main() {
                     1,
                     &[get_integer_type()] as *const _,
                     false,
-                    &[create_integer(10)] as *const _,
+                    &[create_integer(arena, 10)] as *const _,
                 )] as *const _,
             ),
         );
-        add_return(context, create_integer(42));
+        add_return(context, create_integer(arena, 42));
         let ptr = compile(context, c"main".as_ptr());
         delete_context(context);
         ptr()
     };
+    unsafe { delete_expression_arena(arena) };
     println!("{}", result);
 }
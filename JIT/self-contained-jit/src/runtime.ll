@@ -0,0 +1,22 @@
+; Helpers the code generator emits calls to.
+; build.rs assembles this file into bitcode that the backend embeds: the JIT
+; defines the helpers once, and links them into every module that calls them
+; with available_externally linkage, so that the optimizer can inline them.
+; Helpers only define external functions; anything private would be copied
+; into every module.
+
+; Writes a string to stdout as printf("%.*s") would, without a format string
+; to parse, and returns how many characters it has written. Prints call it, so
+; that a print inlines to a call to fwrite. The string is a size and an
+; address, like the fields of a String value.
+@stdout = external global i8*
+
+declare i64 @fwrite(i8*, i64, i64, i8*)
+
+define external i32 @print_string(i64 %length, i64 %address) {
+	%pointer = inttoptr i64 %address to i8*
+	%stream = load i8*, i8** @stdout
+	%written = call i64 @fwrite(i8* %pointer, i64 1, i64 %length, i8* %stream)
+	%ret = trunc i64 %written to i32
+	ret i32 %ret
+}